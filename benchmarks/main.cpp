@@ -0,0 +1,674 @@
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <iterator>
+#include <memory>
+#include <optional>
+#include <tuple>
+#include <utility>
+#include <vector>
+
+#include <benchmark/benchmark.h>
+
+#include <unstately/bulk.h>
+#include <unstately/flat.h>
+#include <unstately/orthogonal.h>
+#include <unstately/replay.h>
+#include <unstately/trace.h>
+#include <unstately/unstately.h>
+
+namespace {
+
+// The turnstile model used by most benchmarks, see `examples/turnstile`.
+struct Context {
+    std::uint64_t beeps{};
+};
+
+struct CoinInserted {};
+struct ArmPushed {};
+
+// Engine and allocation policy combinations under test.
+struct Unique {
+    template <typename... TT>
+    using Allocator = unstately::UniqueStateAllocator;
+    template <typename S>
+    using Machine = unstately::StateMachine<S>;
+};
+
+struct Static {
+    template <typename... TT>
+    using Allocator = unstately::StaticStateAllocator;
+    template <typename S>
+    using Machine = unstately::StateMachine<S>;
+};
+
+struct ThreadLocal {
+    template <typename... TT>
+    using Allocator = unstately::ThreadLocalStateAllocator;
+    template <typename S>
+    using Machine = unstately::StateMachine<S>;
+};
+
+struct Reused {
+    template <typename... TT>
+    using Allocator = unstately::ReusedStateAllocator<TT...>;
+    template <typename S>
+    using Machine = unstately::StateMachine<S>;
+};
+
+struct Pooled {
+    template <typename... TT>
+    using Allocator = unstately::PoolStateAllocator<>;
+    template <typename S>
+    using Machine = unstately::StateMachine<S>;
+};
+
+struct Inline {
+    template <typename... TT>
+    using Allocator = unstately::InlineStateAllocator<TT...>;
+    template <typename S>
+    using Machine = unstately::StateMachine<S>;
+};
+
+struct Variant {
+    template <typename... TT>
+    using Allocator = unstately::VariantStateAllocator<TT...>;
+    template <typename S>
+    using Machine = unstately::VariantStateMachine<S>;
+};
+
+// Same as above, committing transitions only once the next state has been entered.
+struct PooledTransactional {
+    template <typename... TT>
+    using Allocator = unstately::PoolStateAllocator<>;
+    template <typename S>
+    using Machine =
+        unstately::StateMachine<S, unstately::NullObserver, 0, unstately::TransactionalTransitions>;
+};
+
+struct VariantTransactional {
+    template <typename... TT>
+    using Allocator = unstately::VariantStateAllocator<TT...>;
+    template <typename S>
+    using Machine = unstately::VariantStateMachine<S, unstately::NullObserver,
+                                                   unstately::TransactionalTransitions>;
+};
+
+template <typename P>
+struct Turnstile {
+    class Locked;
+    class Unlocked;
+
+    using State = unstately::State<typename P::template Allocator<Locked, Unlocked>, Context,
+                                   CoinInserted, ArmPushed>;
+    using Machine = typename P::template Machine<State>;
+
+    class Locked : public State {
+    public:
+        void entry(Context&) override {}
+
+        void exit(Context&) override {}
+
+        void handle(Context&, const CoinInserted&) override {
+            this->template request_transition<Unlocked>();
+        }
+
+        void handle(Context& context, const ArmPushed&) override {
+            ++context.beeps;
+        }
+    };
+
+    class Unlocked : public State {
+    public:
+        void entry(Context&) override {}
+
+        void exit(Context&) override {}
+
+        void handle(Context&, const CoinInserted&) override {}
+
+        void handle(Context&, const ArmPushed&) override {
+            this->template request_transition<Locked>();
+        }
+    };
+};
+
+// Dispatches an event that the current state handles without changing state.
+template <typename P>
+void dispatch_without_transition(benchmark::State& bm) {
+    using Model = Turnstile<P>;
+    typename Model::Machine sm{Context{}, typename Model::Locked{}};
+    for (auto _ : bm) {
+        sm.dispatch(ArmPushed{});
+    }
+    bm.SetItemsProcessed(bm.iterations());
+}
+
+// Dispatches events that make the state machine go back and forth between two states.
+template <typename P>
+void dispatch_with_transition(benchmark::State& bm) {
+    using Model = Turnstile<P>;
+    typename Model::Machine sm{Context{}, typename Model::Locked{}};
+    for (auto _ : bm) {
+        sm.dispatch(CoinInserted{});
+        sm.dispatch(ArmPushed{});
+    }
+    bm.SetItemsProcessed(2 * bm.iterations());
+}
+
+// Constructs and destroys a state machine, including the initial entry and final exit.
+template <typename P>
+void construct_and_destroy(benchmark::State& bm) {
+    using Model = Turnstile<P>;
+    for (auto _ : bm) {
+        typename Model::Machine sm{Context{}, typename Model::Locked{}};
+        benchmark::DoNotOptimize(&sm);
+    }
+    bm.SetItemsProcessed(bm.iterations());
+}
+
+// A state that restarts itself on every tick, either in place or with a self-transition.
+struct Tick {};
+
+template <bool InPlace>
+class Retry : public unstately::UniqueState<Context, Tick> {
+public:
+    Retry() = default;
+
+    explicit Retry(std::uint64_t attempt) : attempt_{attempt} {}
+
+    void entry(Context&) override {}
+
+    void exit(Context&) override {}
+
+    void handle(Context&, const Tick&) override {
+        if constexpr (InPlace) {
+            reset_state<Retry>(attempt_ + 1);
+        } else {
+            request_transition<Retry>(attempt_ + 1);
+        }
+    }
+
+private:
+    std::uint64_t attempt_{};
+};
+
+template <bool InPlace>
+void dispatch_self_reset(benchmark::State& bm) {
+    unstately::StateMachine<unstately::UniqueState<Context, Tick>> sm{Context{}, Retry<InPlace>{}};
+    for (auto _ : bm) {
+        sm.dispatch(Tick{});
+    }
+    bm.SetItemsProcessed(bm.iterations());
+}
+
+// A state that answers each request with a follow-up event, either raised internally or
+// dispatched by the caller after the request.
+struct Request {};
+struct Reply {};
+
+template <bool Internal>
+class Server : public unstately::UniqueState<Context, Request, Reply> {
+public:
+    void entry(Context&) override {}
+
+    void exit(Context&) override {}
+
+    void handle(Context&, const Request&) override {
+        if constexpr (Internal) {
+            raise(Reply{});
+        }
+    }
+
+    void handle(Context& context, const Reply&) override {
+        ++context.beeps;
+    }
+};
+
+template <bool Internal>
+void dispatch_follow_up(benchmark::State& bm) {
+    using State = unstately::UniqueState<Context, Request, Reply>;
+    unstately::StateMachine<State, unstately::NullObserver, Internal ? 4 : 0> sm{
+        Context{}, Server<Internal>{}};
+    for (auto _ : bm) {
+        sm.dispatch(Request{});
+        if constexpr (!Internal) {
+            sm.dispatch(Reply{});
+        }
+    }
+    bm.SetItemsProcessed(2 * bm.iterations());
+}
+
+// A state that has nothing to do on requests, either with an empty handler or by listing
+// them as ignored.
+template <bool Ignore>
+class Bystander : public unstately::UniqueState<Context, Request, Reply> {
+public:
+    using Ignored = std::conditional_t<Ignore, unstately::TypeList<Request>, unstately::TypeList<>>;
+
+    void entry(Context&) override {}
+
+    void exit(Context&) override {}
+
+    void handle(Context&, const Request&) override {}
+
+    void handle(Context& context, const Reply&) override {
+        ++context.beeps;
+    }
+};
+
+template <bool Ignore>
+void dispatch_ignored(benchmark::State& bm) {
+    using State = unstately::UniqueState<Context, Request, Reply>;
+    unstately::StateMachine<State> sm{Context{}, Bystander<Ignore>{}};
+    for (auto _ : bm) {
+        sm.dispatch(Request{});
+    }
+    bm.SetItemsProcessed(bm.iterations());
+}
+
+// An observer that counts reactions and transitions, to compare with the default one.
+class CountingObserver {
+public:
+    void before_react(unstately::TypeId, std::size_t) {}
+
+    void after_react(unstately::TypeId, std::size_t, bool transition) {
+        ++reactions;
+        transitions += transition ? 1 : 0;
+    }
+
+    void before_exit(unstately::TypeId) {}
+
+    void after_exit(unstately::TypeId) {}
+
+    void before_entry(unstately::TypeId) {}
+
+    void after_entry(unstately::TypeId) {}
+
+    std::uint64_t reactions{};
+    std::uint64_t transitions{};
+};
+
+// The turnstile model with states that carry no data, for FlatStateMachine.
+struct FlatTurnstile {
+    struct Locked;
+    struct Unlocked;
+
+    struct Locked {
+        constexpr Unlocked on(const CoinInserted&) const;
+
+        void on(Context& context, const ArmPushed&) {
+            ++context.beeps;
+        }
+    };
+
+    struct Unlocked {
+        constexpr Locked on(const ArmPushed&) const {
+            return {};
+        }
+    };
+
+    using Machine = unstately::FlatStateMachine<Context, unstately::TypeList<Locked, Unlocked>,
+                                                unstately::TypeList<CoinInserted, ArmPushed>>;
+};
+
+constexpr FlatTurnstile::Unlocked FlatTurnstile::Locked::on(const CoinInserted&) const {
+    return {};
+}
+
+// Dispatches the events of the turnstile to its flat counterpart, either beeping without
+// changing state or going back and forth between the two states.
+template <bool Transition>
+void dispatch_flat(benchmark::State& bm) {
+    FlatTurnstile::Machine sm{Context{}, FlatTurnstile::Locked{}};
+    for (auto _ : bm) {
+        if constexpr (Transition) {
+            sm.dispatch(CoinInserted{});
+        }
+        sm.dispatch(ArmPushed{});
+        benchmark::DoNotOptimize(sm.state_index());
+    }
+    bm.SetItemsProcessed((Transition ? 2 : 1) * bm.iterations());
+}
+
+// Dispatches events with an observer attached to the state machine.
+template <typename O>
+void dispatch_observed(benchmark::State& bm) {
+    using Model = Turnstile<Unique>;
+    unstately::StateMachine<Model::State, O> sm{Context{}, Model::Locked{}};
+    for (auto _ : bm) {
+        sm.dispatch(ArmPushed{});
+    }
+    benchmark::DoNotOptimize(&sm.observer());
+    bm.SetItemsProcessed(bm.iterations());
+}
+
+// Dispatches events while recording the reactions to a trace ring.
+void dispatch_traced(benchmark::State& bm) {
+    using Model = Turnstile<Unique>;
+    using Observer = unstately::TracingObserver<>;
+    unstately::TraceRing<> ring;
+    unstately::StateMachine<Model::State, Observer> sm{Context{}, Model::Locked{}, Observer{ring}};
+    for (auto _ : bm) {
+        sm.dispatch(ArmPushed{});
+    }
+    benchmark::DoNotOptimize(ring.recorded());
+    bm.SetItemsProcessed(bm.iterations());
+}
+
+// Same turnstile as above, whose actions cannot throw.
+struct NothrowTurnstile {
+    class Locked;
+    class Unlocked;
+
+    using State = unstately::State<unstately::VariantStateAllocator<Locked, Unlocked>, Context,
+                                   CoinInserted, ArmPushed>;
+    using Machine = unstately::VariantStateMachine<State, unstately::TracingObserver<>>;
+
+    class Locked : public State {
+    public:
+        void entry(Context&) noexcept override {}
+
+        void exit(Context&) noexcept override {}
+
+        void handle(Context&, const CoinInserted&) noexcept override {
+            request_transition<Unlocked>();
+        }
+
+        void handle(Context& context, const ArmPushed&) noexcept override {
+            ++context.beeps;
+        }
+    };
+
+    class Unlocked : public State {
+    public:
+        void entry(Context&) noexcept override {}
+
+        void exit(Context&) noexcept override {}
+
+        void handle(Context&, const CoinInserted&) noexcept override {}
+
+        void handle(Context&, const ArmPushed&) noexcept override {
+            request_transition<Locked>();
+        }
+    };
+};
+
+static_assert(NothrowTurnstile::Machine::nothrow_dispatch<CoinInserted> &&
+                  NothrowTurnstile::Machine::nothrow_dispatch<ArmPushed>,
+              "Tracing shall not make dispatching throw");
+
+// Dispatches events that make a variant state machine transition while recording the
+// reactions to a trace ring.
+void dispatch_traced_with_transition(benchmark::State& bm) {
+    using Model = NothrowTurnstile;
+    unstately::TraceRing<> ring;
+    Model::Machine sm{Context{}, Model::Locked{}, Model::Machine::Observer{ring}};
+    for (auto _ : bm) {
+        sm.dispatch(CoinInserted{});
+        sm.dispatch(ArmPushed{});
+    }
+    benchmark::DoNotOptimize(ring.recorded());
+    bm.SetItemsProcessed(2 * bm.iterations());
+}
+
+// A model with a configurable number of events, all handled without changing state.
+template <std::size_t I>
+struct Event {};
+
+template <typename S, typename E, typename... EE>
+class Handlers : public Handlers<S, EE...> {
+public:
+    using Handlers<S, EE...>::handle;
+
+    void handle(typename S::Context& context, const E&) override {
+        ++context.beeps;
+    }
+};
+
+template <typename S, typename E>
+class Handlers<S, E> : public S {
+public:
+    void entry(typename S::Context&) override {}
+
+    void exit(typename S::Context&) override {}
+
+    void handle(typename S::Context& context, const E&) override {
+        ++context.beeps;
+    }
+};
+
+template <typename Seq>
+struct Wide;
+
+template <std::size_t... II>
+struct Wide<std::index_sequence<II...>> {
+    using State = unstately::UniqueState<Context, Event<II>...>;
+    using Machine = unstately::StateMachine<State>;
+
+    class Idle : public Handlers<State, Event<II>...> {};
+};
+
+template <typename Seq>
+struct CompactWide;
+
+template <std::size_t... II>
+struct CompactWide<std::index_sequence<II...>> {
+    using State = unstately::CompactState<unstately::UniqueStateAllocator, Context, Event<II>...>;
+    using Machine = unstately::StateMachine<State>;
+
+    class Idle : public State {
+    public:
+        void entry(Context&) override {}
+
+        void exit(Context&) override {}
+
+        template <std::size_t I>
+        void handle(Context& context, const Event<I>&) {
+            ++context.beeps;
+        }
+    };
+};
+
+// Dispatches the I-th event of a model with N events, which may involve a different
+// this-pointer adjustment depending on the position of its handler in the vtables.
+template <std::size_t N, std::size_t I>
+void dispatch_event_of_many(benchmark::State& bm) {
+    using Model = Wide<std::make_index_sequence<N>>;
+    typename Model::Machine sm{Context{}, typename Model::Idle{}};
+    for (auto _ : bm) {
+        sm.dispatch(Event<I>{});
+    }
+    bm.SetItemsProcessed(bm.iterations());
+}
+
+// Same as above, with states that carry a single vtable pointer and a handler table.
+template <std::size_t N, std::size_t I>
+void dispatch_compact_event_of_many(benchmark::State& bm) {
+    using Model = CompactWide<std::make_index_sequence<N>>;
+    typename Model::Machine sm{Context{}, typename Model::Idle{}};
+    for (auto _ : bm) {
+        sm.dispatch(Event<I>{});
+    }
+    bm.SetItemsProcessed(bm.iterations());
+}
+
+// Dispatches each push to three turnstiles, either regions of a single state machine over
+// a shared context or separate state machines.
+template <bool Orthogonal>
+void dispatch_to_regions(benchmark::State& bm) {
+    using Model = Turnstile<Unique>;
+    using State = Model::State;
+    if constexpr (Orthogonal) {
+        unstately::OrthogonalStateMachine<unstately::TypeList<State, State, State>> sm{
+            Context{}, std::make_tuple(Model::Locked{}, Model::Locked{}, Model::Locked{})};
+        for (auto _ : bm) {
+            sm.dispatch(ArmPushed{});
+        }
+        benchmark::DoNotOptimize(&sm.context());
+    } else {
+        std::array<std::optional<unstately::StateMachine<State>>, 3> fleet;
+        for (auto& sm : fleet) {
+            sm.emplace(Context{}, Model::Locked{});
+        }
+        for (auto _ : bm) {
+            for (auto& sm : fleet) {
+                sm->dispatch(ArmPushed{});
+            }
+        }
+        benchmark::DoNotOptimize(&fleet);
+    }
+    bm.SetItemsProcessed(bm.iterations());
+}
+
+// Replays a log of runs of coins and pushes, the length of the runs being the argument,
+// either decoded straight into the event types or into the variant of the events, then
+// visited.
+template <bool Direct>
+void replay_log(benchmark::State& bm) {
+    using Model = Turnstile<Unique>;
+    using Log = unstately::EventLog<Model::State>;
+    const auto run = static_cast<std::size_t>(bm.range(0));
+    std::vector<std::byte> log;
+    for (std::size_t i = 0; i < 2048; ++i) {
+        if (i / run % 2 == 0) {
+            Log::append(log, CoinInserted{});
+        } else {
+            Log::append(log, ArmPushed{});
+        }
+    }
+    const std::byte* records = log.data() + sizeof(Log::Header);
+    const std::size_t length = log.size() - sizeof(Log::Header);
+    unstately::StateMachine<Model::State> sm{Context{}, Model::Locked{}};
+    for (auto _ : bm) {
+        if constexpr (Direct) {
+            benchmark::DoNotOptimize(Log::replay(sm, records, length));
+        } else {
+            using Decoder = Model::State::Event (*)(const std::byte*);
+            static constexpr Decoder decoders[] = {
+                [](const std::byte*) -> Model::State::Event { return CoinInserted{}; },
+                [](const std::byte*) -> Model::State::Event { return ArmPushed{}; }};
+            for (std::size_t i = 0; i < length; i += sizeof(Log::EventId)) {
+                Log::EventId id{};
+                std::memcpy(&id, records + i, sizeof(id));
+                if (id >= std::size(decoders)) {
+                    break;
+                }
+                sm.dispatch(decoders[id](records + i + sizeof(id)));
+            }
+        }
+    }
+    bm.SetItemsProcessed(bm.iterations() * 2048);
+}
+
+// Dispatches a push to each turnstile of a fleet stored column-wise, with or without
+// inserting a coin first to make all the turnstiles change state twice.
+template <bool Transition>
+void broadcast_to_bulk_fleet(benchmark::State& bm) {
+    using Model = Turnstile<Variant>;
+    const auto size = static_cast<std::size_t>(bm.range(0));
+    unstately::BulkStateMachine<typename Model::State> fleet{};
+    fleet.reserve(size);
+    for (std::size_t i = 0; i < size; ++i) {
+        fleet.add(Context{}, typename Model::Locked{});
+    }
+    for (auto _ : bm) {
+        if constexpr (Transition) {
+            fleet.broadcast(CoinInserted{});
+        }
+        fleet.broadcast(ArmPushed{});
+    }
+    bm.SetItemsProcessed((Transition ? 2 : 1) * bm.iterations() * bm.range(0));
+}
+
+// Same as broadcast_to_bulk_fleet, with a fleet of separate state machines.
+template <bool Transition>
+void broadcast_to_machine_fleet(benchmark::State& bm) {
+    using Model = Turnstile<Variant>;
+    std::vector<std::unique_ptr<typename Model::Machine>> fleet;
+    for (std::int64_t i = 0; i < bm.range(0); ++i) {
+        fleet.push_back(std::make_unique<typename Model::Machine>(Context{},
+                                                                  typename Model::Locked{}));
+    }
+    for (auto _ : bm) {
+        if constexpr (Transition) {
+            for (auto& sm : fleet) {
+                sm->dispatch(CoinInserted{});
+            }
+        }
+        for (auto& sm : fleet) {
+            sm->dispatch(ArmPushed{});
+        }
+    }
+    bm.SetItemsProcessed((Transition ? 2 : 1) * bm.iterations() * bm.range(0));
+}
+
+} // namespace
+
+BENCHMARK_TEMPLATE(dispatch_without_transition, Unique);
+BENCHMARK_TEMPLATE(dispatch_without_transition, Static);
+BENCHMARK_TEMPLATE(dispatch_without_transition, ThreadLocal);
+BENCHMARK_TEMPLATE(dispatch_without_transition, Reused);
+BENCHMARK_TEMPLATE(dispatch_without_transition, Pooled);
+BENCHMARK_TEMPLATE(dispatch_without_transition, Inline);
+BENCHMARK_TEMPLATE(dispatch_without_transition, Variant);
+
+BENCHMARK_TEMPLATE(dispatch_with_transition, Unique);
+BENCHMARK_TEMPLATE(dispatch_with_transition, Static);
+BENCHMARK_TEMPLATE(dispatch_with_transition, ThreadLocal);
+BENCHMARK_TEMPLATE(dispatch_with_transition, Reused);
+BENCHMARK_TEMPLATE(dispatch_with_transition, Pooled);
+BENCHMARK_TEMPLATE(dispatch_with_transition, Inline);
+BENCHMARK_TEMPLATE(dispatch_with_transition, Variant);
+BENCHMARK_TEMPLATE(dispatch_with_transition, PooledTransactional);
+BENCHMARK_TEMPLATE(dispatch_with_transition, VariantTransactional);
+
+BENCHMARK_TEMPLATE(dispatch_flat, false);
+BENCHMARK_TEMPLATE(dispatch_flat, true);
+
+BENCHMARK_TEMPLATE(construct_and_destroy, Unique);
+BENCHMARK_TEMPLATE(construct_and_destroy, Static);
+BENCHMARK_TEMPLATE(construct_and_destroy, ThreadLocal);
+BENCHMARK_TEMPLATE(construct_and_destroy, Reused);
+BENCHMARK_TEMPLATE(construct_and_destroy, Pooled);
+BENCHMARK_TEMPLATE(construct_and_destroy, Inline);
+BENCHMARK_TEMPLATE(construct_and_destroy, Variant);
+
+BENCHMARK_TEMPLATE(dispatch_self_reset, true);
+BENCHMARK_TEMPLATE(dispatch_self_reset, false);
+
+BENCHMARK_TEMPLATE(dispatch_follow_up, true);
+BENCHMARK_TEMPLATE(dispatch_follow_up, false);
+
+BENCHMARK_TEMPLATE(dispatch_ignored, false);
+BENCHMARK_TEMPLATE(dispatch_ignored, true);
+
+BENCHMARK_TEMPLATE(dispatch_observed, unstately::NullObserver);
+BENCHMARK_TEMPLATE(dispatch_observed, CountingObserver);
+BENCHMARK(dispatch_traced);
+BENCHMARK(dispatch_traced_with_transition);
+
+BENCHMARK_TEMPLATE(dispatch_event_of_many, 1, 0);
+BENCHMARK_TEMPLATE(dispatch_event_of_many, 8, 0);
+BENCHMARK_TEMPLATE(dispatch_event_of_many, 8, 7);
+BENCHMARK_TEMPLATE(dispatch_event_of_many, 32, 0);
+BENCHMARK_TEMPLATE(dispatch_event_of_many, 32, 31);
+
+BENCHMARK_TEMPLATE(dispatch_compact_event_of_many, 1, 0);
+BENCHMARK_TEMPLATE(dispatch_compact_event_of_many, 8, 0);
+BENCHMARK_TEMPLATE(dispatch_compact_event_of_many, 8, 7);
+BENCHMARK_TEMPLATE(dispatch_compact_event_of_many, 32, 0);
+BENCHMARK_TEMPLATE(dispatch_compact_event_of_many, 32, 31);
+
+BENCHMARK_TEMPLATE(dispatch_to_regions, true);
+BENCHMARK_TEMPLATE(dispatch_to_regions, false);
+
+BENCHMARK_TEMPLATE(replay_log, true)->Arg(1)->Arg(64);
+BENCHMARK_TEMPLATE(replay_log, false)->Arg(1)->Arg(64);
+
+BENCHMARK_TEMPLATE(broadcast_to_bulk_fleet, false)->Arg(1 << 10)->Arg(1 << 20);
+BENCHMARK_TEMPLATE(broadcast_to_bulk_fleet, true)->Arg(1 << 10)->Arg(1 << 20);
+BENCHMARK_TEMPLATE(broadcast_to_machine_fleet, false)->Arg(1 << 10)->Arg(1 << 20);
+BENCHMARK_TEMPLATE(broadcast_to_machine_fleet, true)->Arg(1 << 10)->Arg(1 << 20);
+
+BENCHMARK_MAIN();
@@ -0,0 +1,91 @@
+#include <atomic>
+#include <iostream>
+#include <thread>
+#include <vector>
+
+#include <unstately/async.h>
+#include <unstately/unstately.h>
+
+// Counts what happened to the turnstile.
+// It is only touched by the consumer thread, thus it needs no synchronization.
+struct Counters {
+    int passages{};
+    int beeps{};
+};
+
+// The `Context` class here gives access to the counters.
+struct Context {
+    Counters* counters{};
+};
+
+// Define the events.
+struct CoinInserted {};
+struct ArmPushed {};
+
+// Define some useful shortcuts.
+using State = unstately::UniqueState<Context, CoinInserted, ArmPushed>;
+using StateMachine = unstately::AsyncStateMachine<unstately::StateMachine<State>>;
+
+class Locked : public State {
+public:
+    void entry(Context&) override {}
+
+    void exit(Context&) override {}
+
+    void handle(Context&, const CoinInserted&) override;
+
+    void handle(Context& context, const ArmPushed&) override {
+        ++context.counters->beeps;
+    }
+};
+
+class Unlocked : public State {
+public:
+    void entry(Context&) override {}
+
+    void exit(Context& context) override {
+        ++context.counters->passages;
+    }
+
+    void handle(Context&, const CoinInserted&) override {}
+
+    void handle(Context&, const ArmPushed&) override {
+        request_transition<Locked>();
+    }
+};
+
+void Locked::handle(Context&, const CoinInserted&) {
+    request_transition<Unlocked>();
+}
+
+int main() {
+    constexpr int events_per_producer = 100000;
+
+    // Create the state machine with an initial state.
+    Counters counters{};
+    auto sm = StateMachine{Context{&counters}, Locked{}};
+
+    // Any thread can post events without locking.
+    std::atomic<int> running_producers{2};
+    auto produce = [&](auto event) {
+        for (int i = 0; i < events_per_producer; ++i) {
+            sm.post(event);
+        }
+        --running_producers;
+    };
+    std::vector<std::thread> producers;
+    producers.emplace_back(produce, CoinInserted{});
+    producers.emplace_back(produce, ArmPushed{});
+
+    // A single consumer thread, here the main one, dispatches the events.
+    std::size_t dispatched = 0;
+    while (running_producers > 0 || dispatched < 2 * events_per_producer) {
+        dispatched += sm.poll();
+    }
+    for (auto& producer : producers) {
+        producer.join();
+    }
+
+    std::cout << "Dispatched " << dispatched << " events: " << counters.passages << " passages, "
+              << counters.beeps << " beeps" << '\n';
+}
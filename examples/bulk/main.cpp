@@ -0,0 +1,74 @@
+#include <cstddef>
+#include <iostream>
+
+#include <unstately/bulk.h>
+#include <unstately/unstately.h>
+
+// The `Context` class here counts the passages through one turnstile of a large fleet.
+struct Context {
+    int passages{};
+};
+
+// Define the events.
+struct CoinInserted {};
+struct ArmPushed {};
+
+// Define some useful shortcuts. The variant allocator lists the states, one column each.
+class Locked;
+class Unlocked;
+using State = unstately::State<unstately::VariantStateAllocator<Locked, Unlocked>, Context,
+                               CoinInserted, ArmPushed>;
+using Fleet = unstately::BulkStateMachine<State>;
+
+class Locked : public State {
+public:
+    void entry(Context&) override {}
+
+    void exit(Context&) override {}
+
+    void handle(Context&, const CoinInserted&) override;
+
+    void handle(Context&, const ArmPushed&) override {}
+};
+
+class Unlocked : public State {
+public:
+    void entry(Context&) override {}
+
+    void exit(Context& context) override {
+        ++context.passages;
+    }
+
+    void handle(Context&, const CoinInserted&) override {}
+
+    void handle(Context&, const ArmPushed&) override {
+        request_transition<Locked>();
+    }
+};
+
+void Locked::handle(Context&, const CoinInserted&) {
+    request_transition<Unlocked>();
+}
+
+int main() {
+    constexpr std::size_t turnstiles = 1000000;
+
+    // Create the fleet, whose instances are stored column-wise.
+    Fleet fleet{};
+    fleet.reserve(turnstiles);
+    for (std::size_t i = 0; i < turnstiles; ++i) {
+        fleet.add(Context{}, Locked{});
+    }
+
+    // Insert a coin in the first half of the fleet, then push all the arms.
+    fleet.broadcast(CoinInserted{}, 0, turnstiles / 2);
+    std::cout << fleet.count<Unlocked>() << " turnstiles unlocked" << '\n';
+    fleet.broadcast(ArmPushed{});
+    std::cout << fleet.count<Unlocked>() << " turnstiles unlocked" << '\n';
+
+    // Single instances can be addressed too.
+    fleet.dispatch(0, CoinInserted{});
+    fleet.dispatch(0, ArmPushed{});
+    std::cout << "Counted " << fleet.context(0).passages << " passages through the first turnstile"
+              << '\n';
+}
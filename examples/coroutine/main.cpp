@@ -0,0 +1,142 @@
+#include <coroutine>
+#include <iostream>
+#include <memory>
+#include <vector>
+
+#include <unstately/coroutine.h>
+#include <unstately/graph.h>
+#include <unstately/unstately.h>
+
+// A simulated database of the cards allowed through the turnstiles, whose lookups
+// complete only when the event loop polls it.
+class Database {
+public:
+    // The awaitable object of a lookup.
+    struct Lookup {
+        bool await_ready() const noexcept {
+            return false;
+        }
+
+        void await_suspend(std::coroutine_handle<> handle) {
+            database->pending_.push_back({handle, card, &allowed});
+        }
+
+        bool await_resume() const noexcept {
+            return allowed;
+        }
+
+        Database* database;
+        int card;
+        bool allowed{};
+    };
+
+    Lookup lookup(int card) {
+        return Lookup{this, card};
+    }
+
+    // Completes the pending lookups, resuming the coroutines that await them.
+    void poll() {
+        std::vector<Request> completed;
+        completed.swap(pending_);
+        for (const Request& request : completed) {
+            *request.allowed = request.card % 2 == 0;
+            request.handle.resume();
+        }
+    }
+
+private:
+    struct Request {
+        std::coroutine_handle<> handle;
+        int card;
+        bool* allowed;
+    };
+
+    std::vector<Request> pending_{};
+};
+
+// The `Context` class here counts the passages through one turnstile.
+struct Context {
+    Database* database{};
+    int passages{};
+};
+
+// Define the events.
+struct CardSwiped {
+    int card;
+};
+struct ArmPushed {};
+
+// Define some useful shortcuts.
+class Locked;
+class Unlocked;
+using State = unstately::UniqueState<Context, CardSwiped, ArmPushed>;
+
+// The locked state awaits the database before unlocking, without blocking the thread.
+class Locked : public State {
+public:
+    using Targets = unstately::TypeList<Unlocked>;
+
+    void entry(Context&) override {}
+
+    void exit(Context&) override {}
+
+    // Not called, since the awaiting handler below takes precedence.
+    void handle(Context&, const CardSwiped&) override {}
+
+    unstately::Task handle_async(Context& context, const CardSwiped& e);
+
+    void handle(Context&, const ArmPushed&) override {}
+};
+
+class Unlocked : public State {
+public:
+    using Targets = unstately::TypeList<Locked>;
+
+    void entry(Context&) override {}
+
+    void exit(Context& context) override {
+        ++context.passages;
+    }
+
+    void handle(Context&, const CardSwiped&) override {}
+
+    void handle(Context&, const ArmPushed&) override {
+        request_transition<Locked>();
+    }
+};
+
+unstately::Task Locked::handle_async(Context& context, const CardSwiped& e) {
+    const bool allowed = co_await context.database->lookup(e.card);
+    if (allowed) {
+        request_transition<Unlocked>();
+    }
+}
+
+using StateMachine = unstately::AwaitingStateMachine<unstately::StateMachine<State>,
+                                                     unstately::TransitionGraph<Locked>::States>;
+
+int main() {
+    constexpr int turnstiles = 1000;
+
+    // A single thread multiplexes all the turnstiles.
+    Database database{};
+    std::vector<std::unique_ptr<StateMachine>> machines;
+    for (int i = 0; i < turnstiles; ++i) {
+        machines.push_back(std::make_unique<StateMachine>(Context{&database}, Locked{}));
+    }
+
+    // Each turnstile awaits its lookup, buffering the arm pushes that follow.
+    for (int i = 0; i < turnstiles; ++i) {
+        machines[i]->dispatch(CardSwiped{i});
+        machines[i]->dispatch(ArmPushed{});
+    }
+    std::cout << "Awaiting: " << machines[0]->awaiting() << '\n';
+
+    // Lookups complete: the allowed turnstiles unlock, then let the buffered pushes through.
+    database.poll();
+    int passages = 0;
+    for (const auto& machine : machines) {
+        passages += machine->machine().context().passages;
+    }
+    std::cout << "Counted " << passages << " passages" << '\n';
+}
@@ -0,0 +1,83 @@
+#include <atomic>
+#include <iostream>
+#include <thread>
+#include <vector>
+
+#include <unstately/executor.h>
+#include <unstately/unstately.h>
+
+// The `Context` class here counts the passages through one turnstile.
+// Each state machine is dispatched by one worker at a time, thus it needs no synchronization.
+struct Context {
+    int passages{};
+    std::atomic<int>* total_passages{};
+};
+
+// Define the events.
+struct CoinInserted {};
+struct ArmPushed {};
+
+// Define some useful shortcuts.
+using State = unstately::PooledState<Context, CoinInserted, ArmPushed>;
+using Executor = unstately::Executor<unstately::StateMachine<State>>;
+
+class Locked : public State {
+public:
+    void entry(Context&) override {}
+
+    void exit(Context&) override {}
+
+    void handle(Context&, const CoinInserted&) override;
+
+    void handle(Context&, const ArmPushed&) override {}
+};
+
+class Unlocked : public State {
+public:
+    void entry(Context&) override {}
+
+    void exit(Context& context) override {
+        ++context.passages;
+        context.total_passages->fetch_add(1, std::memory_order_relaxed);
+    }
+
+    void handle(Context&, const CoinInserted&) override {}
+
+    void handle(Context&, const ArmPushed&) override {
+        request_transition<Locked>();
+    }
+};
+
+void Locked::handle(Context&, const CoinInserted&) {
+    request_transition<Unlocked>();
+}
+
+int main() {
+    constexpr int turnstiles = 1000;
+    constexpr int passages_per_turnstile = 100;
+
+    // Create the executor, which owns all the state machines.
+    std::atomic<int> total_passages{};
+    Executor executor{};
+    std::vector<Executor::Handle> handles;
+    for (int i = 0; i < turnstiles; ++i) {
+        handles.push_back(executor.spawn(Context{0, &total_passages}, Locked{}));
+    }
+
+    // Any thread can post events to any state machine.
+    auto produce = [&](int first, int last) {
+        for (int n = 0; n < passages_per_turnstile; ++n) {
+            for (int i = first; i < last; ++i) {
+                executor.post(handles[i], CoinInserted{});
+                executor.post(handles[i], ArmPushed{});
+            }
+        }
+    };
+    std::thread producer{produce, 0, turnstiles / 2};
+    produce(turnstiles / 2, turnstiles);
+    producer.join();
+
+    // Wait for the workers to dispatch all the events.
+    executor.wait_idle();
+    std::cout << "Counted " << total_passages << " passages" << '\n';
+}
@@ -0,0 +1,109 @@
+#include <cstddef>
+#include <iostream>
+#include <optional>
+#include <vector>
+
+#include <unstately/graph.h>
+#include <unstately/snapshot.h>
+#include <unstately/unstately.h>
+
+// The `Context` class here counts the passages through one turnstile.
+// It is trivially copyable, so that it can be saved as is.
+struct Context {
+    int passages{};
+};
+
+// Define the events.
+struct CoinInserted {};
+struct ArmPushed {};
+
+// Define some useful shortcuts.
+class Locked;
+class Unlocked;
+using State = unstately::UniqueState<Context, CoinInserted, ArmPushed>;
+using Machine = unstately::StateMachine<State>;
+
+// The locked state counts the attempts to push the arm, and saves them in snapshots.
+class Locked : public State {
+public:
+    using Targets = unstately::TypeList<Unlocked>;
+
+    Locked() = default;
+
+    explicit Locked(int attempts) : attempts_{attempts} {}
+
+    int save() const {
+        return attempts_;
+    }
+
+    void entry(Context&) override {
+        std::cout << "Arm is LOCKED" << '\n';
+    }
+
+    void exit(Context&) override {}
+
+    void handle(Context&, const CoinInserted&) override;
+
+    void handle(Context&, const ArmPushed&) override {
+        ++attempts_;
+        std::cout << "Buzzer BEEPED " << attempts_ << " times" << '\n';
+    }
+
+private:
+    int attempts_{};
+};
+
+// The unlocked state saves no data.
+class Unlocked : public State {
+public:
+    using Targets = unstately::TypeList<Locked>;
+
+    void entry(Context&) override {
+        std::cout << "Arm is UNLOCKED" << '\n';
+    }
+
+    void exit(Context& context) override {
+        ++context.passages;
+    }
+
+    void handle(Context&, const CoinInserted&) override {}
+
+    void handle(Context&, const ArmPushed&) override {
+        request_transition<Locked>();
+    }
+};
+
+void Locked::handle(Context&, const CoinInserted&) {
+    request_transition<Unlocked>();
+}
+
+// The states to save are those reachable from the initial state, as they declare.
+using Graph = unstately::TransitionGraph<Locked>;
+static_assert(Graph::complete, "All the states shall declare their targets");
+using Snapshot = Graph::Apply<unstately::Snapshot, Machine>;
+
+int main() {
+    // Save a fleet of two turnstiles to an array of records, as it could be in a file.
+    std::vector<std::byte> records(2 * Snapshot::size);
+    {
+        Machine first{Context{}, Locked{}};
+        first.dispatch(ArmPushed{});
+        first.dispatch(ArmPushed{});
+        Machine second{Context{}, Locked{}};
+        second.dispatch(CoinInserted{});
+        Snapshot::save(first, records.data());
+        Snapshot::save(second, records.data() + Snapshot::size);
+    }
+
+    // Restore the turnstiles: they resume from their states without entering them again.
+    std::optional<Machine> first;
+    std::optional<Machine> second;
+    if (!Snapshot::restore(first, records.data(), records.size()) ||
+        !Snapshot::restore(second, records.data() + Snapshot::size,
+                           records.size() - Snapshot::size)) {
+        return 1;
+    }
+    first->dispatch(ArmPushed{});
+    second->dispatch(ArmPushed{});
+    std::cout << "Counted " << second->context().passages << " passages" << '\n';
+}
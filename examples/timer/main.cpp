@@ -0,0 +1,98 @@
+#include <cstdint>
+#include <iostream>
+#include <memory>
+#include <vector>
+
+#include <unstately/graph.h>
+#include <unstately/timer.h>
+#include <unstately/unstately.h>
+
+// The `Context` class here counts what happened to one turnstile.
+struct Context {
+    int passages{};
+    int timeouts{};
+};
+
+// Define the events, including the one dispatched when a timeout expires.
+struct CoinInserted {};
+struct ArmPushed {};
+
+// Define some useful shortcuts.
+class Locked;
+class Unlocked;
+using State = unstately::UniqueState<Context, CoinInserted, ArmPushed, unstately::Timeout>;
+
+class Locked : public State {
+public:
+    using Targets = unstately::TypeList<Unlocked>;
+
+    void entry(Context&) override {}
+
+    void exit(Context&) override {}
+
+    void handle(Context&, const CoinInserted&) override;
+
+    void handle(Context&, const ArmPushed&) override {}
+
+    void handle(Context&, const unstately::Timeout&) override {}
+};
+
+// The unlocked state locks again if the arm is not pushed within 30 ticks.
+class Unlocked : public State {
+public:
+    using Targets = unstately::TypeList<Locked>;
+
+    static constexpr std::uint64_t timeout = 30;
+
+    void entry(Context&) override {}
+
+    void exit(Context&) override {}
+
+    void handle(Context&, const CoinInserted&) override {}
+
+    void handle(Context& context, const ArmPushed&) override {
+        ++context.passages;
+        request_transition<Locked>();
+    }
+
+    void handle(Context& context, const unstately::Timeout&) override {
+        ++context.timeouts;
+        request_transition<Locked>();
+    }
+};
+
+void Locked::handle(Context&, const CoinInserted&) {
+    request_transition<Unlocked>();
+}
+
+using StateMachine =
+    unstately::TimedStateMachine<State, unstately::TransitionGraph<Locked>::States>;
+
+int main() {
+    constexpr int turnstiles = 100000;
+
+    // All the turnstiles share a single timer wheel.
+    unstately::TimerWheel wheel{};
+    std::vector<std::unique_ptr<StateMachine>> machines;
+    for (int i = 0; i < turnstiles; ++i) {
+        machines.push_back(std::make_unique<StateMachine>(wheel, Context{}, Locked{}));
+    }
+
+    // Every turnstile gets a coin, but only one out of four sees its arm pushed in time.
+    for (int i = 0; i < turnstiles; ++i) {
+        machines[i]->dispatch(CoinInserted{});
+    }
+    wheel.advance(10);
+    for (int i = 0; i < turnstiles; i += 4) {
+        machines[i]->dispatch(ArmPushed{});
+    }
+    wheel.advance(30);
+
+    int passages = 0;
+    int timeouts = 0;
+    for (const auto& machine : machines) {
+        passages += machine->machine().context().passages;
+        timeouts += machine->machine().context().timeouts;
+    }
+    std::cout << "Counted " << passages << " passages and " << timeouts << " timeouts" << '\n';
+}
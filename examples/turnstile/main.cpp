@@ -7,6 +7,16 @@
 // By default, this example creates states on the heap.
 // Uncomment the following line to create states with static storage instead.
 // #define UNSTATELY_EXAMPLE_TURNSTILE_STATIC
+// Uncomment the following line to create states with thread-local storage instead.
+// #define UNSTATELY_EXAMPLE_TURNSTILE_THREAD_LOCAL
+// Uncomment the following line to reuse states stored inside the state machine instead.
+// #define UNSTATELY_EXAMPLE_TURNSTILE_REUSED
+// Uncomment the following line to recycle state storage from a pool instead.
+// #define UNSTATELY_EXAMPLE_TURNSTILE_POOLED
+// Uncomment the following line to store states inside the state machine instead.
+// #define UNSTATELY_EXAMPLE_TURNSTILE_INLINE
+// Uncomment the following line to dispatch events with std::visit instead of vtables.
+// #define UNSTATELY_EXAMPLE_TURNSTILE_VARIANT
 
 // The `Context` class here represents the application-specific
 // context in which the state machine acts.
@@ -31,12 +41,34 @@ struct CoinInserted {};
 struct ArmPushed {};
 using Event = std::variant<ArmPushed, CoinInserted>;
 
+// Declare the states, which some allocation policies need to know in advance.
+class Locked;
+class Unlocked;
+
 // Define some useful shortcuts.
-#ifndef UNSTATELY_EXAMPLE_TURNSTILE_STATIC
-using State = unstately::UniqueState<Context, CoinInserted, ArmPushed>;
+#if defined(UNSTATELY_EXAMPLE_TURNSTILE_STATIC)
+using State = unstately::StaticState<Context, CoinInserted, ArmPushed>;
+using StateMachine = unstately::StateMachine<State>;
+#elif defined(UNSTATELY_EXAMPLE_TURNSTILE_THREAD_LOCAL)
+using State = unstately::ThreadLocalState<Context, CoinInserted, ArmPushed>;
+using StateMachine = unstately::StateMachine<State>;
+#elif defined(UNSTATELY_EXAMPLE_TURNSTILE_REUSED)
+using State = unstately::State<unstately::ReusedStateAllocator<Locked, Unlocked>, Context,
+                               CoinInserted, ArmPushed>;
 using StateMachine = unstately::StateMachine<State>;
+#elif defined(UNSTATELY_EXAMPLE_TURNSTILE_POOLED)
+using State = unstately::PooledState<Context, CoinInserted, ArmPushed>;
+using StateMachine = unstately::StateMachine<State>;
+#elif defined(UNSTATELY_EXAMPLE_TURNSTILE_INLINE)
+using State = unstately::State<unstately::InlineStateAllocator<Locked, Unlocked>, Context,
+                               CoinInserted, ArmPushed>;
+using StateMachine = unstately::StateMachine<State>;
+#elif defined(UNSTATELY_EXAMPLE_TURNSTILE_VARIANT)
+using State = unstately::State<unstately::VariantStateAllocator<Locked, Unlocked>, Context,
+                               CoinInserted, ArmPushed>;
+using StateMachine = unstately::VariantStateMachine<State>;
 #else
-using State = unstately::StaticState<Context, CoinInserted, ArmPushed>;
+using State = unstately::UniqueState<Context, CoinInserted, ArmPushed>;
 using StateMachine = unstately::StateMachine<State>;
 #endif
 
@@ -91,8 +123,6 @@ int main() {
     // Create the state machine with an initial state.
     auto sm = StateMachine{Context{}, Locked{}};
 
-    // Dispatch the events.
-    for (const auto& event : event_queue) {
-        std::visit([&](auto&& e) { sm.dispatch(e); }, event);
-    }
+    // Dispatch the events in a single batch.
+    sm.dispatch_all(event_queue.begin(), event_queue.end());
 }
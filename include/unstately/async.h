@@ -0,0 +1,214 @@
+/*
+ * Unstately - A very simple state machine implementation in C++
+ *
+ * Copyright (c) 2023 Michele Consonni
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef UNSTATELY_ASYNC_H_
+#define UNSTATELY_ASYNC_H_
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <new>
+#include <thread>
+#include <utility>
+
+#include <unstately/unstately.h>
+
+namespace unstately {
+
+/**
+ * @brief A bounded, lock-free, multi-producer/single-consumer FIFO queue.
+ *        Any thread can push, while only one thread at a time shall pop.
+ * @tparam T Type of the queued elements.
+ * @tparam N Capacity of the queue. Shall be a power of two.
+ */
+template <typename T, std::size_t N>
+class MpscQueue {
+public:
+    static_assert(N > 0 && (N & (N - 1)) == 0, "Queue capacity shall be a power of two");
+
+    MpscQueue() {
+        for (std::size_t i = 0; i < N; ++i) {
+            cells_[i].sequence.store(i, std::memory_order_relaxed);
+        }
+    }
+
+    ~MpscQueue() {
+        while (try_pop([](T&&) {})) {
+        }
+    }
+
+    MpscQueue(const MpscQueue& rhs) = delete;
+
+    MpscQueue& operator=(const MpscQueue& rhs) = delete;
+
+    /**
+     * @brief Pushes a new element, unless the queue is full. Safe to call from any thread.
+     * @tparam Args Type list of the arguments to forward to T constructor.
+     * @param args Arguments to forward to T constructor.
+     * @return true if the element has been pushed, false if the queue is full.
+     */
+    template <typename... Args>
+    bool try_push(Args&&... args) {
+        std::size_t position = tail_.load(std::memory_order_relaxed);
+        for (;;) {
+            Cell& cell = cells_[position & (N - 1)];
+            const std::size_t sequence = cell.sequence.load(std::memory_order_acquire);
+            const auto distance =
+                static_cast<std::intptr_t>(sequence) - static_cast<std::intptr_t>(position);
+            if (distance == 0) {
+                if (tail_.compare_exchange_weak(position, position + 1,
+                                                std::memory_order_relaxed)) {
+                    ::new (cell.storage) T(std::forward<Args>(args)...);
+                    cell.sequence.store(position + 1, std::memory_order_release);
+                    return true;
+                }
+            } else if (distance < 0) {
+                return false;
+            } else {
+                position = tail_.load(std::memory_order_relaxed);
+            }
+        }
+    }
+
+    /**
+     * @brief Pops the oldest element, if any, and passes it to the input function.
+     *        The cell is given back to producers before the function is called.
+     *        Shall be called by the consumer thread only.
+     * @tparam F Type of the function to call, taking a T rvalue reference.
+     * @param f Function to call with the popped element.
+     * @return true if an element has been popped, false if the queue is empty.
+     */
+    template <typename F>
+    bool try_pop(F&& f) {
+        Cell& cell = cells_[head_ & (N - 1)];
+        if (cell.sequence.load(std::memory_order_acquire) != head_ + 1) {
+            return false;
+        }
+        T& stored = *std::launder(reinterpret_cast<T*>(cell.storage));
+        T value{std::move(stored)};
+        stored.~T();
+        cell.sequence.store(head_ + N, std::memory_order_release);
+        ++head_;
+        std::forward<F>(f)(std::move(value));
+        return true;
+    }
+
+private:
+    struct Cell {
+        std::atomic<std::size_t> sequence;
+        alignas(T) std::byte storage[sizeof(T)];
+    };
+
+    alignas(detail::cache_line_size) std::atomic<std::size_t> tail_{};
+    alignas(detail::cache_line_size) std::size_t head_{};
+    alignas(detail::cache_line_size) Cell cells_[N];
+};
+
+/**
+ * @brief A front-end that lets any thread post events to a state machine, which a single
+ *        consumer thread then dispatches in order, preserving run-to-completion semantics.
+ *        Events are held in a lock-free queue of the machine State::Event variant.
+ * @tparam M Type of the wrapped state machine, _e.g._, StateMachine or VariantStateMachine.
+ * @tparam N Capacity of the event queue. Shall be a power of two.
+ */
+template <typename M, std::size_t N = 1024>
+class AsyncStateMachine {
+public:
+    /**
+     * @brief Type of the wrapped state machine.
+     */
+    using Machine = M;
+
+    /**
+     * @brief Type able to hold any of the events that the state machine handles.
+     */
+    using Event = typename Machine::State::Event;
+
+    /**
+     * @brief Constructs the wrapped state machine in place.
+     * @tparam Args Type list of the arguments to forward to the state machine constructor.
+     * @param args Arguments to forward to the state machine constructor.
+     */
+    template <typename... Args>
+    explicit AsyncStateMachine(Args&&... args) : machine_{std::forward<Args>(args)...} {}
+
+    AsyncStateMachine(const AsyncStateMachine& rhs) = delete;
+
+    AsyncStateMachine& operator=(const AsyncStateMachine& rhs) = delete;
+
+    /**
+     * @brief Posts an event, unless the queue is full. Safe to call from any thread.
+     * @tparam E Type of the event to post.
+     * @param e  Event to post.
+     * @return true if the event has been queued, false if the queue is full.
+     */
+    template <typename E>
+    bool try_post(E&& e) {
+        return queue_.try_push(std::forward<E>(e));
+    }
+
+    /**
+     * @brief Posts an event, yielding while the queue is full. Safe to call from any thread.
+     * @tparam E Type of the event to post.
+     * @param e  Event to post.
+     */
+    template <typename E>
+    void post(const E& e) {
+        while (!queue_.try_push(e)) {
+            std::this_thread::yield();
+        }
+    }
+
+    /**
+     * @brief Dispatches the queued events, up to the input maximum number.
+     *        Shall be called by the consumer thread only.
+     * @param max_events Maximum number of events to dispatch.
+     * @return std::size_t Number of dispatched events.
+     */
+    std::size_t poll(std::size_t max_events = N) {
+        std::size_t count = 0;
+        while (count < max_events &&
+               queue_.try_pop([this](Event&& e) { machine_.dispatch(e); })) {
+            ++count;
+        }
+        return count;
+    }
+
+    /**
+     * @brief Gives access to the wrapped state machine.
+     *        Shall be used by the consumer thread only.
+     * @return Machine& The wrapped state machine.
+     */
+    Machine& machine() {
+        return machine_;
+    }
+
+private:
+    MpscQueue<Event, N> queue_{};
+    Machine machine_;
+};
+
+} // namespace unstately
+
+#endif // UNSTATELY_ASYNC_H_
@@ -0,0 +1,341 @@
+/*
+ * Unstately - A very simple state machine implementation in C++
+ *
+ * Copyright (c) 2023 Michele Consonni
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef UNSTATELY_BULK_H_
+#define UNSTATELY_BULK_H_
+
+#include <algorithm>
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <tuple>
+#include <type_traits>
+#include <utility>
+#include <variant>
+#include <vector>
+
+#include <unstately/unstately.h>
+
+namespace unstately {
+
+/**
+ * @brief A container of many instances of the same state machine, stored column-wise:
+ *        a compact state index and a context per instance, and one array per state type
+ *        holding the states of the instances that are currently in it.
+ *        States shall use a VariantStateAllocator, whose type list gives the columns, and
+ *        shall be move constructible and move assignable.
+ *        Instances are identified by their insertion index.
+ * @tparam S Base class of the states.
+ * @tparam A Allocation policy of the states.
+ */
+template <typename S, typename A = typename S::Allocator>
+class BulkStateMachine;
+
+template <typename S, typename... TT>
+class BulkStateMachine<S, VariantStateAllocator<TT...>>
+    : private detail::StorageHolder<VariantStateAllocator<TT...>> {
+public:
+    /**
+     * @brief Base class of the states.
+     */
+    using State = S;
+
+    /**
+     * @brief Allocation policy type used to create new states.
+     */
+    using StateAllocator = typename State::Allocator;
+
+    /**
+     * @brief Type of the context of each instance.
+     */
+    using Context = typename State::Context;
+
+    /**
+     * @brief Compact identifier of the current state of an instance.
+     */
+    using StateIndex =
+        std::conditional_t<(sizeof...(TT) <= UINT8_MAX), std::uint8_t, std::uint16_t>;
+
+    /**
+     * @brief Index of the state type T in the list of states, as given by
+     *        BulkStateMachine::state_index.
+     * @tparam T Concrete type of the state.
+     */
+    template <typename T>
+    static constexpr StateIndex index_of = detail::IndexOf<T, TT...>::value;
+
+    BulkStateMachine() = default;
+
+    /**
+     * @brief Executes the exit actions of all the instances.
+     */
+    ~BulkStateMachine() {
+        (exit_all<TT>(), ...);
+    }
+
+    BulkStateMachine(const BulkStateMachine& rhs) = delete;
+
+    BulkStateMachine& operator=(const BulkStateMachine& rhs) = delete;
+
+    /**
+     * @brief Reserves room for the input number of instances.
+     * @param count Number of instances.
+     */
+    void reserve(std::size_t count) {
+        states_.reserve(count);
+        slots_.reserve(count);
+        contexts_.reserve(count);
+        order_.reserve(count);
+    }
+
+    /**
+     * @brief Adds a new instance initialized with the input initial state.
+     * @tparam T Concrete type of the initial state.
+     * @param context       Context of the instance.
+     * @param initial_state Initial state to start from.
+     * @return std::size_t Index of the new instance.
+     */
+    template <typename T>
+    std::size_t add(Context&& context, T&& initial_state) {
+        const std::size_t instance = size();
+        contexts_.push_back(std::move(context));
+        states_.push_back(index_of<T>);
+        slots_.push_back(0);
+        // Build the state in the policy storage, so that it is bound to it, then move it
+        auto built = this->template make_state_ptr<T>(std::move(initial_state));
+        built->info_ = &detail::StateDescriptor<State, T>::info;
+        T& state = place(instance, std::move(*built));
+        detail::Hierarchy<State, T>::entry(state, contexts_[instance],
+                                           detail::Hierarchy<State, T>::depth);
+        return instance;
+    }
+
+    /**
+     * @brief Gives the number of instances.
+     * @return std::size_t Number of instances.
+     */
+    std::size_t size() const noexcept {
+        return states_.size();
+    }
+
+    /**
+     * @brief Gives the number of instances currently in the state T.
+     * @tparam T Concrete type of the state.
+     * @return std::size_t Number of instances in the state.
+     */
+    template <typename T>
+    std::size_t count() const noexcept {
+        return std::get<Column<T>>(columns_).states.size();
+    }
+
+    /**
+     * @brief Gives the current state of an instance.
+     * @param instance Index of the instance.
+     * @return StateIndex Index of the current state type in the list of states.
+     */
+    StateIndex state_index(std::size_t instance) const noexcept {
+        return states_[instance];
+    }
+
+    /**
+     * @brief Gives the identifier of the concrete type of the current state of an instance.
+     * @param instance Index of the instance.
+     * @return TypeId Identifier of the current state type.
+     */
+    TypeId type_id(std::size_t instance) const noexcept {
+        static constexpr TypeId ids[] = {unstately::type_id<TT>()...};
+        return ids[states_[instance]];
+    }
+
+    /**
+     * @brief Gives access to the context of an instance.
+     * @param instance Index of the instance.
+     * @return Context& Context of the instance.
+     */
+    Context& context(std::size_t instance) {
+        return contexts_[instance];
+    }
+
+    /**
+     * @brief Dispatches the incoming event to one instance.
+     * @tparam E Type of the event to dispatch.
+     * @param instance Index of the instance.
+     * @param e        Event to dispatch.
+     */
+    template <typename E>
+    void dispatch(std::size_t instance, const E& e) {
+        using Thunk = void (BulkStateMachine::*)(std::uint32_t, const E&);
+        static constexpr Thunk thunks[] = {&BulkStateMachine::react<TT, E>...};
+        (this->*thunks[states_[instance]])(static_cast<std::uint32_t>(instance), e);
+    }
+
+    /**
+     * @brief Dispatches the incoming event to a range of instances, as if
+     *        BulkStateMachine::dispatch was called on each of them.
+     *        The instances are first grouped by current state, then each group is served by
+     *        its own loop, in which the handlers are called directly rather than through
+     *        the virtual table. Instances that change state are not served twice.
+     * @tparam E Type of the event to dispatch.
+     * @param e     Event to dispatch.
+     * @param first Index of the first instance.
+     * @param last  Index past the last instance.
+     */
+    template <typename E>
+    void broadcast(const E& e, std::size_t first, std::size_t last) {
+        const std::array<std::size_t, sizeof...(TT) + 1> offsets = group(first, last);
+        std::size_t index = 0;
+        ((serve<TT>(e, offsets[index], offsets[index + 1]), ++index), ...);
+    }
+
+    /**
+     * @brief Dispatches the incoming event to all the instances, as if
+     *        BulkStateMachine::dispatch was called on each of them in an unspecified order.
+     *        The state columns are served in turn, each by its own loop, and instances that
+     *        change state are not served twice.
+     * @tparam E Type of the event to dispatch.
+     * @param e  Event to dispatch.
+     */
+    template <typename E>
+    void broadcast(const E& e) {
+        const std::array<std::size_t, sizeof...(TT)> sizes{count<TT>()...};
+        std::size_t index = 0;
+        (serve_column<TT>(e, sizes[index++]), ...);
+    }
+
+private:
+    template <typename T>
+    struct Column {
+        std::vector<T> states{};
+        std::vector<std::uint32_t> owners{};
+    };
+
+    // Sorts the instances by current state into order_, giving where each group begins
+    std::array<std::size_t, sizeof...(TT) + 1> group(std::size_t first, std::size_t last) {
+        const StateIndex* begin = states_.data() + first;
+        const StateIndex* end = states_.data() + last;
+        std::array<std::size_t, sizeof...(TT) + 1> offsets{};
+        for (std::size_t i = 0; i < sizeof...(TT); ++i) {
+            // Comparing the state indexes against a constant is a loop that vectorizes
+            const auto index = static_cast<StateIndex>(i);
+            offsets[i + 1] = offsets[i] + static_cast<std::size_t>(std::count(begin, end, index));
+        }
+        order_.resize(last - first);
+        std::array<std::size_t, sizeof...(TT) + 1> next = offsets;
+        for (std::size_t instance = first; instance < last; ++instance) {
+            order_[next[states_[instance]]++] = static_cast<std::uint32_t>(instance);
+        }
+        return offsets;
+    }
+
+    template <typename T, typename E>
+    void serve(const E& e, std::size_t first, std::size_t last) {
+        for (std::size_t i = first; i < last; ++i) {
+            react<T>(order_[i], e);
+        }
+    }
+
+    // The hole left by a state that changes is filled by the last one of the column, which
+    // is either a state served already or one that came in during this broadcast
+    template <typename T, typename E>
+    void serve_column(const E& e, std::size_t size) {
+        Column<T>& column = std::get<Column<T>>(columns_);
+        for (std::size_t slot = size; slot-- > 0;) {
+            react(column.states[slot], column.owners[slot], e);
+        }
+    }
+
+    template <typename T, typename E>
+    void react(std::uint32_t instance, const E& e) {
+        react(std::get<Column<T>>(columns_).states[slots_[instance]], instance, e);
+    }
+
+    template <typename T, typename E>
+    void react(T& state, std::uint32_t instance, const E& e) {
+        if (!detail::admits(state, contexts_[instance], e)) {
+            return;
+        }
+        detail::handle_event<T>(state, contexts_[instance], e);
+        if (auto next_state = state.take_next_state()) {
+            // The next state is the only one held by the policy storage until it is moved out
+            std::visit([this, instance, &state](auto& target) {
+                change_state(instance, state, target);
+            }, this->storage().slot(0));
+        }
+    }
+
+    template <typename T, typename U>
+    void change_state(std::uint32_t instance, T& source, U& target) {
+        if constexpr (!std::is_same_v<U, std::monostate>) {
+            constexpr detail::TransitionLevels levels =
+                detail::transition_levels<State, typename detail::ParentOf<T>::type, U>(1);
+            Context& context = contexts_[instance];
+            detail::Hierarchy<State, T>::exit(source, context, levels.exit);
+            remove<T>(instance);
+            U& state = place(instance, std::move(target));
+            detail::Hierarchy<State, U>::entry(state, context, levels.entry);
+        }
+    }
+
+    template <typename T>
+    T& place(std::size_t instance, T&& state) {
+        Column<T>& column = std::get<Column<T>>(columns_);
+        states_[instance] = index_of<T>;
+        slots_[instance] = static_cast<std::uint32_t>(column.states.size());
+        column.owners.push_back(static_cast<std::uint32_t>(instance));
+        return column.states.emplace_back(std::move(state));
+    }
+
+    // Fills the hole left by the removed state with the last one of the column
+    template <typename T>
+    void remove(std::uint32_t instance) {
+        Column<T>& column = std::get<Column<T>>(columns_);
+        const std::uint32_t slot = slots_[instance];
+        if (slot + 1 != column.states.size()) {
+            column.states[slot] = std::move(column.states.back());
+            column.owners[slot] = column.owners.back();
+            slots_[column.owners[slot]] = slot;
+        }
+        column.states.pop_back();
+        column.owners.pop_back();
+    }
+
+    template <typename T>
+    void exit_all() {
+        Column<T>& column = std::get<Column<T>>(columns_);
+        for (std::size_t i = 0; i < column.states.size(); ++i) {
+            detail::Hierarchy<State, T>::exit(column.states[i], contexts_[column.owners[i]],
+                                              detail::Hierarchy<State, T>::depth);
+        }
+    }
+
+    std::vector<StateIndex> states_{};
+    std::vector<std::uint32_t> slots_{};
+    std::vector<Context> contexts_{};
+    std::tuple<Column<TT>...> columns_{};
+    std::vector<std::uint32_t> order_{};
+};
+
+} // namespace unstately
+
+#endif // UNSTATELY_BULK_H_
@@ -0,0 +1,351 @@
+/*
+ * Unstately - A very simple state machine implementation in C++
+ *
+ * Copyright (c) 2023 Michele Consonni
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef UNSTATELY_COROUTINE_H_
+#define UNSTATELY_COROUTINE_H_
+
+#if !defined(__cpp_impl_coroutine)
+#error "unstately/coroutine.h requires C++20 coroutines"
+#endif
+
+#include <algorithm>
+#include <coroutine>
+#include <cstddef>
+#include <exception>
+#include <optional>
+#include <type_traits>
+#include <utility>
+#include <variant>
+
+#include <unstately/unstately.h>
+
+namespace unstately {
+
+template <typename M, typename L, std::size_t N>
+class AwaitingStateMachine;
+
+/**
+ * @brief The coroutine type returned by awaiting handlers, _i.e._, by the `handle_async`
+ *        member functions of states, and by the coroutines that they await in turn.
+ *        It starts suspended and is run by AwaitingStateMachine, or by the coroutine that
+ *        awaits it.
+ *        Notice: exceptions escaping the coroutine terminate the program, since there may
+ *        be no caller of StateMachine::dispatch left to receive them.
+ */
+class Task {
+public:
+    class promise_type;
+
+private:
+    using Handle = std::coroutine_handle<promise_type>;
+
+    struct FinalAwaiter {
+        bool await_ready() const noexcept {
+            return false;
+        }
+
+        // The owner may destroy the coroutine, whose frame is thus not touched afterwards
+        std::coroutine_handle<> await_suspend(Handle handle) const noexcept;
+
+        void await_resume() const noexcept {}
+    };
+
+    struct Awaiter {
+        bool await_ready() const noexcept {
+            return false;
+        }
+
+        std::coroutine_handle<> await_suspend(std::coroutine_handle<> awaiting) const noexcept;
+
+        void await_resume() const noexcept {}
+
+        Handle handle;
+    };
+
+public:
+    /**
+     * @brief Promise type of the coroutine.
+     */
+    class promise_type {
+    public:
+        Task get_return_object() noexcept {
+            return Task{Handle::from_promise(*this)};
+        }
+
+        std::suspend_always initial_suspend() const noexcept {
+            return {};
+        }
+
+        FinalAwaiter final_suspend() const noexcept {
+            return {};
+        }
+
+        void return_void() const noexcept {}
+
+        [[noreturn]] void unhandled_exception() const noexcept {
+            std::terminate();
+        }
+
+    private:
+        friend class Task;
+
+        template <typename, typename, std::size_t>
+        friend class AwaitingStateMachine;
+
+        std::coroutine_handle<> continuation_{};
+        void* owner_{};
+        void (*done_)(void*){};
+    };
+
+    Task() = default;
+
+    ~Task() {
+        if (handle_) {
+            handle_.destroy();
+        }
+    }
+
+    Task(const Task& rhs) = delete;
+
+    Task(Task&& rhs) noexcept : handle_{std::exchange(rhs.handle_, nullptr)} {}
+
+    Task& operator=(const Task& rhs) = delete;
+
+    Task& operator=(Task&& rhs) noexcept {
+        Task{std::move(rhs)}.swap(*this);
+        return *this;
+    }
+
+    /**
+     * @brief Lets a coroutine await this one, which runs until completion before the
+     *        awaiting coroutine is resumed.
+     * @return Awaiter Awaitable object.
+     */
+    Awaiter operator co_await() && noexcept {
+        return Awaiter{handle_};
+    }
+
+private:
+    template <typename, typename, std::size_t>
+    friend class AwaitingStateMachine;
+
+    explicit Task(Handle handle) noexcept : handle_{handle} {}
+
+    void swap(Task& rhs) noexcept {
+        std::swap(handle_, rhs.handle_);
+    }
+
+    Handle handle_{};
+};
+
+inline std::coroutine_handle<> Task::FinalAwaiter::await_suspend(Handle handle) const noexcept {
+    promise_type& promise = handle.promise();
+    if (promise.continuation_) {
+        return promise.continuation_;
+    }
+    const auto done = promise.done_;
+    done(promise.owner_);
+    return std::noop_coroutine();
+}
+
+inline std::coroutine_handle<> Task::Awaiter::await_suspend(
+    std::coroutine_handle<> awaiting) const noexcept {
+    handle.promise().continuation_ = awaiting;
+    return handle;
+}
+
+namespace detail {
+
+template <typename T, typename C, typename E, typename = void>
+struct HasAsyncHandler : std::false_type {};
+
+template <typename T, typename C, typename E>
+struct HasAsyncHandler<T, C, E,
+                       std::void_t<decltype(std::declval<T&>().handle_async(
+                           std::declval<C&>(), std::declval<const E&>()))>>
+    : std::is_same<decltype(std::declval<T&>().handle_async(std::declval<C&>(),
+                                                            std::declval<const E&>())),
+                   Task> {};
+
+} // namespace detail
+
+/**
+ * @brief A front-end that lets states await, _e.g._, I/O before deciding the next state,
+ *        without blocking the thread that dispatches the events.
+ *        A state handles an event E by awaiting with a member function
+ *        `Task handle_async(Context&, const E&)`, which takes precedence over its
+ *        EventHandlerUnit::handle implementation. The transition that it requests is
+ *        executed once the coroutine completes, and the events dispatched in the meantime
+ *        are buffered, then dispatched in order.
+ *        Coroutines shall be resumed by the thread that dispatches the events, _e.g._,
+ *        from the event loop that multiplexes many state machines, and the awaited
+ *        event is kept alive until they complete. Deferred events are deferred as usual.
+ * @tparam M Type of the wrapped StateMachine.
+ * @tparam L Type list of the concrete states that may await, _e.g._,
+ *           TransitionGraph::States.
+ * @tparam N Capacity of the buffer of the events dispatched while a coroutine is running.
+ */
+template <typename M, typename L, std::size_t N = 64>
+class AwaitingStateMachine;
+
+template <typename M, typename... TT, std::size_t N>
+class AwaitingStateMachine<M, TypeList<TT...>, N> {
+public:
+    /**
+     * @brief Type of the wrapped state machine.
+     */
+    using Machine = M;
+
+    /**
+     * @brief Base class of the states.
+     */
+    using State = typename Machine::State;
+
+    /**
+     * @brief Type of the state machine context.
+     */
+    using Context = typename Machine::Context;
+
+    /**
+     * @brief Type able to hold any of the events that the state machine handles.
+     */
+    using Event = typename State::Event;
+
+    /**
+     * @brief Constructs the wrapped state machine in place.
+     * @tparam Args Type list of the arguments to forward to the state machine constructor.
+     * @param args Arguments to forward to the state machine constructor.
+     */
+    template <typename... Args>
+    explicit AwaitingStateMachine(Args&&... args) : machine_{std::forward<Args>(args)...} {}
+
+    AwaitingStateMachine(const AwaitingStateMachine& rhs) = delete;
+
+    AwaitingStateMachine& operator=(const AwaitingStateMachine& rhs) = delete;
+
+    /**
+     * @brief Dispatches the incoming event, or buffers it while a coroutine is running.
+     * @tparam E Type of the event to dispatch, possibly a std::variant.
+     * @param e  Event to dispatch.
+     * @return true if the event has been dispatched or buffered, false if the buffer is
+     *         full.
+     */
+    template <typename E>
+    bool dispatch(const E& e) {
+        if (task_.handle_) {
+            return buffer_.push_back(e);
+        }
+        dispatching_ = true;
+        run(e);
+        proceed();
+        dispatching_ = false;
+        return true;
+    }
+
+    /**
+     * @brief Tells whether a coroutine is running, so that incoming events are buffered.
+     * @return true if a coroutine is running.
+     */
+    bool awaiting() const noexcept {
+        return static_cast<bool>(task_.handle_);
+    }
+
+    /**
+     * @brief Gives access to the wrapped state machine.
+     * @return Machine& The wrapped state machine.
+     */
+    Machine& machine() noexcept {
+        return machine_;
+    }
+
+private:
+    template <typename E>
+    void run(const E& e) {
+        if constexpr (detail::IsVariant<E>::value) {
+            std::visit([this](const auto& event) { run(event); }, e);
+        } else {
+            using Thunk = void (AwaitingStateMachine::*)(const E&);
+            static constexpr TypeId ids[] = {type_id<TT>()...};
+            static constexpr Thunk thunks[] = {&AwaitingStateMachine::run_in<TT, E>...};
+            const TypeId current = machine_.state().type_id();
+            const auto found = std::find(std::begin(ids), std::end(ids), current);
+            if (found == std::end(ids)) {
+                machine_.dispatch(e);
+            } else {
+                (this->*thunks[found - std::begin(ids)])(e);
+            }
+        }
+    }
+
+    template <typename T, typename E>
+    void run_in(const E& e) {
+        if constexpr (detail::HasAsyncHandler<T, Context, E>::value && !detail::defers<T, E>) {
+            const T& state = static_cast<const T&>(*machine_.state_);
+            if (!detail::admits(state, machine_.context_ref(), e)) {
+                return;
+            }
+            event_id_ = State::template event_id<E>;
+            machine_.observer().before_react(type_id<T>(), event_id_);
+            const E& event = std::get<E>(event_.emplace(e));
+            task_ = static_cast<T&>(*machine_.state_).handle_async(machine_.context_ref(), event);
+            typename Task::promise_type& promise = task_.handle_.promise();
+            promise.owner_ = this;
+            promise.done_ = &AwaitingStateMachine::done;
+            task_.handle_.resume();
+        } else {
+            machine_.dispatch(e);
+        }
+    }
+
+    // Called by the coroutine once completed, either within dispatch or when resumed later
+    static void done(void* owner) {
+        auto& self = *static_cast<AwaitingStateMachine*>(owner);
+        self.task_ = Task{};
+        self.event_.reset();
+        self.machine_.settle(self.event_id_);
+        if (!self.dispatching_) {
+            self.dispatching_ = true;
+            self.proceed();
+            self.dispatching_ = false;
+        }
+    }
+
+    // Dispatches the buffered events, until one of them starts a coroutine that suspends
+    void proceed() {
+        while (!task_.handle_ && buffer_.pop_front([this](Event&& e) { run(e); })) {
+        }
+    }
+
+    Machine machine_;
+    alignas(Event) std::byte cells_[N * sizeof(Event)];
+    detail::EventRing<Event> buffer_{cells_, N};
+    std::optional<Event> event_{};
+    std::size_t event_id_{};
+    bool dispatching_{};
+    Task task_{};
+};
+
+} // namespace unstately
+
+#endif // UNSTATELY_COROUTINE_H_
@@ -0,0 +1,413 @@
+/*
+ * Unstately - A very simple state machine implementation in C++
+ *
+ * Copyright (c) 2023 Michele Consonni
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef UNSTATELY_EXECUTOR_H_
+#define UNSTATELY_EXECUTOR_H_
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include <unstately/async.h>
+#include <unstately/unstately.h>
+
+namespace unstately {
+
+/**
+ * @brief Placement of the worker threads of an Executor, _e.g._, on the nodes of a NUMA
+ *        system.
+ */
+struct WorkerPlacement {
+    //! Number of domains that the workers are split into, each one made of consecutive
+    //! workers. Workers only steal machines from the workers of their own domain.
+    std::size_t domains{1};
+    //! Called on each worker thread with its index before it serves any machine, _e.g._, to
+    //! pin the thread to the processors of the node of its domain.
+    std::function<void(std::size_t worker)> start{};
+};
+
+/**
+ * @brief An executor that owns many independent state machines and dispatches their events
+ *        on a pool of worker threads.
+ *        Each machine has a lock-free mailbox and a home worker to which it is scheduled
+ *        whenever it receives events; idle workers steal ready machines from the others.
+ *        A machine is scheduled at most once at any time, so it is never dispatched on two
+ *        threads at once and its events are dispatched in the order they were posted.
+ *        Workers may be split into domains, _e.g._, one per NUMA node, that machines never
+ *        leave. Machines are constructed by a worker of their domain, so that their context
+ *        and initial state are allocated on its node, as are the states they transition to
+ *        with PoolStateAllocator, whose pools belong to the threads. Each machine starts on
+ *        its own cache line, away from its mailbox and from the others.
+ * @tparam M Type of the owned state machines, _e.g._, StateMachine or VariantStateMachine.
+ * @tparam N Capacity of each mailbox. Shall be a power of two.
+ */
+template <typename M, std::size_t N = 64>
+class Executor {
+    struct Slot;
+
+public:
+    /**
+     * @brief Type of the owned state machines.
+     */
+    using Machine = M;
+
+    /**
+     * @brief Type able to hold any of the events that the state machines handle.
+     */
+    using Event = typename Machine::State::Event;
+
+    /**
+     * @brief Reference to a state machine owned by the executor.
+     */
+    class Handle {
+    public:
+        Handle() = default;
+
+    private:
+        friend class Executor;
+
+        explicit Handle(Slot* slot) noexcept : slot_{slot} {}
+
+        Slot* slot_{};
+    };
+
+    /**
+     * @brief Constructs a new executor and starts its worker threads.
+     * @param workers Number of worker threads.
+     * @param batch     Maximum number of events dispatched to a machine before letting the
+     *                  worker serve another one.
+     * @param placement Placement of the worker threads.
+     */
+    explicit Executor(std::size_t workers = default_workers(), std::size_t batch = 64,
+                      WorkerPlacement placement = WorkerPlacement{})
+        : batch_{std::max<std::size_t>(1, batch)},
+          workers_(std::max<std::size_t>(1, workers)),
+          domain_count_{std::clamp<std::size_t>(placement.domains, 1, workers_.size())},
+          start_{std::move(placement.start)} {
+        threads_.reserve(workers_.size());
+        for (std::size_t i = 0; i < workers_.size(); ++i) {
+            threads_.emplace_back([this, i] {
+                if (start_) {
+                    start_(i);
+                }
+                run(i);
+            });
+        }
+    }
+
+    /**
+     * @brief Stops the worker threads. Events that have not been dispatched yet are discarded:
+     *        call Executor::wait_idle before to dispatch them.
+     */
+    ~Executor() {
+        {
+            std::lock_guard<std::mutex> lock{idle_mutex_};
+            stopping_ = true;
+        }
+        for (std::size_t i = 0; i < domain_count_; ++i) {
+            domains_[i].idle_cv.notify_all();
+        }
+        for (auto& thread : threads_) {
+            thread.join();
+        }
+    }
+
+    Executor(const Executor& rhs) = delete;
+
+    Executor& operator=(const Executor& rhs) = delete;
+
+    /**
+     * @brief Creates a new state machine owned by the executor, on a worker of the domain of
+     *        its home, and waits for it. Safe to call from any thread, including the workers,
+     *        which construct the machine themselves.
+     * @tparam Args Type list of the arguments to forward to the state machine constructor.
+     * @param args Arguments to forward to the state machine constructor.
+     * @return Handle Reference to the new state machine.
+     */
+    template <typename... Args>
+    Handle spawn(Args&&... args) {
+        return spawn_at(spawned_.fetch_add(1), std::forward<Args>(args)...);
+    }
+
+    /**
+     * @brief Creates a new state machine owned by the executor, whose home is the input
+     *        worker, _e.g._, to keep a shard on a given node. Otherwise the same as
+     *        Executor::spawn.
+     * @tparam Args Type list of the arguments to forward to the state machine constructor.
+     * @param worker Index of the home worker, modulo the number of workers.
+     * @param args   Arguments to forward to the state machine constructor.
+     * @return Handle Reference to the new state machine.
+     */
+    template <typename... Args>
+    Handle spawn_at(std::size_t worker, Args&&... args) {
+        const std::size_t home = worker % workers_.size();
+        std::unique_ptr<Slot> slot{};
+        std::packaged_task<void()> construction{[&slot, home, &args...] {
+            slot = std::make_unique<Slot>(home, std::forward<Args>(args)...);
+        }};
+        std::future<void> constructed = construction.get_future();
+        // Waiting for another worker could deadlock with one spawning in return
+        if (is_worker()) {
+            construction();
+        } else {
+            request_construction(domains_[domain_of(home)], construction);
+        }
+        constructed.get();
+        std::lock_guard<std::mutex> lock{slots_mutex_};
+        slots_.push_back(std::move(slot));
+        return Handle{slots_.back().get()};
+    }
+
+    /**
+     * @brief Posts an event to a state machine, unless its mailbox is full.
+     *        Safe to call from any thread.
+     * @tparam E Type of the event to post.
+     * @param machine Target state machine.
+     * @param e       Event to post.
+     * @return true if the event has been queued, false if the mailbox is full.
+     */
+    template <typename E>
+    bool try_post(Handle machine, E&& e) {
+        Slot& slot = *machine.slot_;
+        if (!slot.mailbox.try_push(std::forward<E>(e))) {
+            return false;
+        }
+        if (slot.pending.fetch_add(1, std::memory_order_acq_rel) == 0) {
+            schedule(slot, slot.home);
+        }
+        return true;
+    }
+
+    /**
+     * @brief Posts an event to a state machine, yielding while its mailbox is full.
+     *        Safe to call from any thread.
+     * @tparam E Type of the event to post.
+     * @param machine Target state machine.
+     * @param e       Event to post.
+     */
+    template <typename E>
+    void post(Handle machine, const E& e) {
+        while (!try_post(machine, e)) {
+            std::this_thread::yield();
+        }
+    }
+
+    /**
+     * @brief Waits until all the events posted so far have been dispatched.
+     */
+    void wait_idle() {
+        // Handlers may spawn machines meanwhile, which the lock shall thus not be held for
+        for (std::size_t i = 0;; ++i) {
+            Slot* slot = nullptr;
+            {
+                std::lock_guard<std::mutex> lock{slots_mutex_};
+                if (i == slots_.size()) {
+                    return;
+                }
+                slot = slots_[i].get();
+            }
+            while (slot->pending.load(std::memory_order_acquire) != 0) {
+                std::this_thread::yield();
+            }
+        }
+    }
+
+private:
+    struct alignas(detail::cache_line_size) Slot {
+        template <typename... Args>
+        explicit Slot(std::size_t home_worker, Args&&... args)
+            : home{home_worker}, machine{std::forward<Args>(args)...} {}
+
+        MpscQueue<Event, N> mailbox{};
+        std::atomic<std::size_t> pending{};
+        std::size_t home;
+        // Producers keep writing to the counter, which the machine thus does not share
+        alignas(detail::cache_line_size) Machine machine;
+    };
+
+    struct Worker {
+        std::mutex mutex{};
+        std::deque<Slot*> ready{};
+    };
+
+    struct Domain {
+        std::atomic<std::size_t> ready_slots{};
+        std::atomic<std::size_t> sleepers{};
+        std::condition_variable idle_cv{};
+        std::mutex constructions_mutex{};
+        // Machines to construct, on the stack of the threads spawning them
+        std::deque<std::packaged_task<void()>*> constructions{};
+        std::atomic<std::size_t> pending_constructions{};
+    };
+
+    static std::size_t default_workers() {
+        return std::max(1U, std::thread::hardware_concurrency());
+    }
+
+    void schedule(Slot& slot, std::size_t worker) {
+        {
+            std::lock_guard<std::mutex> lock{workers_[worker].mutex};
+            workers_[worker].ready.push_back(&slot);
+        }
+        Domain& domain = domains_[domain_of(worker)];
+        domain.ready_slots.fetch_add(1);
+        wake(domain);
+    }
+
+    void request_construction(Domain& domain, std::packaged_task<void()>& construction) {
+        {
+            std::lock_guard<std::mutex> lock{domain.constructions_mutex};
+            domain.constructions.push_back(&construction);
+        }
+        domain.pending_constructions.fetch_add(1);
+        wake(domain);
+    }
+
+    void wake(Domain& domain) {
+        if (domain.sleepers.load() > 0) {
+            // Pairs with the predicate check in wait_for_work, so that no wake-up is lost
+            {
+                std::lock_guard<std::mutex> lock{idle_mutex_};
+            }
+            domain.idle_cv.notify_one();
+        }
+    }
+
+    bool is_worker() const noexcept {
+        const std::thread::id id = std::this_thread::get_id();
+        return std::any_of(threads_.begin(), threads_.end(),
+                           [id](const std::thread& thread) { return thread.get_id() == id; });
+    }
+
+    std::size_t domain_of(std::size_t worker) const noexcept {
+        return worker * domain_count_ / workers_.size();
+    }
+
+    // First worker of a domain, i.e., the lowest index that domain_of maps to it
+    std::size_t domain_begin(std::size_t domain) const noexcept {
+        return (domain * workers_.size() + domain_count_ - 1) / domain_count_;
+    }
+
+    Slot* take(std::size_t index) {
+        const std::size_t domain = domain_of(index);
+        const std::size_t begin = domain_begin(domain);
+        const std::size_t size = domain_begin(domain + 1) - begin;
+        for (std::size_t i = 0; i < size; ++i) {
+            Worker& worker = workers_[begin + (index - begin + i) % size];
+            std::lock_guard<std::mutex> lock{worker.mutex};
+            if (!worker.ready.empty()) {
+                Slot* slot = nullptr;
+                // Serve the own queue in FIFO order and steal the most recent entries
+                if (i == 0) {
+                    slot = worker.ready.front();
+                    worker.ready.pop_front();
+                } else {
+                    slot = worker.ready.back();
+                    worker.ready.pop_back();
+                }
+                domains_[domain].ready_slots.fetch_sub(1);
+                return slot;
+            }
+        }
+        return nullptr;
+    }
+
+    bool construct(std::size_t index) {
+        Domain& domain = domains_[domain_of(index)];
+        std::packaged_task<void()>* construction = nullptr;
+        {
+            std::lock_guard<std::mutex> lock{domain.constructions_mutex};
+            if (domain.constructions.empty()) {
+                return false;
+            }
+            construction = domain.constructions.front();
+            domain.constructions.pop_front();
+        }
+        domain.pending_constructions.fetch_sub(1);
+        (*construction)();
+        return true;
+    }
+
+    bool wait_for_work(std::size_t index) {
+        Domain& domain = domains_[domain_of(index)];
+        domain.sleepers.fetch_add(1);
+        std::unique_lock<std::mutex> lock{idle_mutex_};
+        domain.idle_cv.wait(lock, [this, &domain] {
+            return stopping_ || domain.ready_slots.load() > 0 ||
+                   domain.pending_constructions.load() > 0;
+        });
+        domain.sleepers.fetch_sub(1);
+        return !stopping_;
+    }
+
+    void process(Slot& slot, std::size_t index) {
+        const std::size_t count =
+            std::min(slot.pending.load(std::memory_order_acquire), batch_);
+        // A producer may count its event before an earlier one has been written to the
+        // mailbox: the pop then fails, and the pending events are left for the next round
+        std::size_t popped = 0;
+        while (popped < count &&
+               slot.mailbox.try_pop([&slot](Event&& e) { slot.machine.dispatch(e); })) {
+            ++popped;
+        }
+        if (slot.pending.fetch_sub(popped, std::memory_order_acq_rel) != popped) {
+            schedule(slot, index);
+        }
+    }
+
+    void run(std::size_t index) {
+        for (;;) {
+            if (Slot* slot = take(index)) {
+                process(*slot, index);
+            } else if (!construct(index) && !wait_for_work(index)) {
+                return;
+            }
+        }
+    }
+
+    const std::size_t batch_;
+    std::vector<Worker> workers_;
+    const std::size_t domain_count_;
+    std::function<void(std::size_t)> start_;
+    std::vector<std::thread> threads_{};
+    std::mutex slots_mutex_{};
+    std::vector<std::unique_ptr<Slot>> slots_{};
+    std::atomic<std::size_t> spawned_{};
+    std::unique_ptr<Domain[]> domains_{new Domain[domain_count_]};
+    std::mutex idle_mutex_{};
+    bool stopping_{};
+};
+
+} // namespace unstately
+
+#endif // UNSTATELY_EXECUTOR_H_
@@ -0,0 +1,356 @@
+/*
+ * Unstately - A very simple state machine implementation in C++
+ *
+ * Copyright (c) 2023 Michele Consonni
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef UNSTATELY_FLAT_H_
+#define UNSTATELY_FLAT_H_
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <type_traits>
+#include <utility>
+#include <variant>
+
+#include <unstately/unstately.h>
+
+namespace unstately {
+
+namespace detail {
+
+/**
+ * @brief Tells whether the flat state T reacts to the event E through a member function
+ *        `on(Context&, const E&)`, which may act on the context C, and gives its result.
+ */
+template <typename T, typename C, typename E, typename = void>
+struct ActingReaction : std::false_type {
+    using type = void;
+};
+
+template <typename T, typename C, typename E>
+struct ActingReaction<T, C, E,
+                      std::void_t<decltype(std::declval<T&>().on(std::declval<C&>(),
+                                                                 std::declval<const E&>()))>>
+    : std::true_type {
+    using type = decltype(std::declval<T&>().on(std::declval<C&>(), std::declval<const E&>()));
+};
+
+/**
+ * @brief Tells whether the flat state T reacts to the event E through a member function
+ *        `on(const E&) const`, which does not touch the context, and gives its result.
+ */
+template <typename T, typename E, typename = void>
+struct PureReaction : std::false_type {
+    using type = void;
+};
+
+template <typename T, typename E>
+struct PureReaction<
+    T, E, std::void_t<decltype(std::declval<const T&>().on(std::declval<const E&>()))>>
+    : std::true_type {
+    using type = decltype(std::declval<const T&>().on(std::declval<const E&>()));
+};
+
+/**
+ * @brief The reaction of the flat state T to the event E: whether it reacts at all, whether
+ *        it acts on the context C, and the next state, which is T itself if it does not
+ *        transition.
+ */
+template <typename T, typename C, typename E>
+struct FlatReaction {
+    static_assert(!(ActingReaction<T, C, E>::value && PureReaction<T, E>::value),
+                  "Flat states shall react to an event through a single on() overload");
+
+    static constexpr bool acts = ActingReaction<T, C, E>::value;
+    static constexpr bool reacts = acts || PureReaction<T, E>::value;
+
+    using Target = typename std::conditional_t<acts, ActingReaction<T, C, E>,
+                                               PureReaction<T, E>>::type;
+
+    static constexpr bool transition = !std::is_void_v<Target>;
+
+    using Next = std::conditional_t<transition, Target, T>;
+};
+
+template <typename T, typename C, typename = void>
+struct HasFlatEntry : std::false_type {};
+
+template <typename T, typename C>
+struct HasFlatEntry<T, C, std::void_t<decltype(std::declval<T&>().entry(std::declval<C&>()))>>
+    : std::true_type {};
+
+template <typename T, typename C, typename = void>
+struct HasFlatExit : std::false_type {};
+
+template <typename T, typename C>
+struct HasFlatExit<T, C, std::void_t<decltype(std::declval<T&>().exit(std::declval<C&>()))>>
+    : std::true_type {};
+
+/**
+ * @brief Gives the indexes of the next states of the flat states TT for the event E.
+ */
+template <typename I, typename C, typename E, typename... TT>
+constexpr std::array<I, sizeof...(TT)> flat_next_states() {
+    return {static_cast<I>(IndexOf<typename FlatReaction<TT, C, E>::Next, TT...>::value)...};
+}
+
+} // namespace detail
+
+/**
+ * @brief A state machine whose states carry no data, compiled down to a constexpr table of
+ *        the next states and a one-byte index of the current state.
+ *        States are empty classes, which do not derive from State. A state reacts to an
+ *        event E through a constexpr member function `Next on(const E&) const`, returning
+ *        a value of the type of the next state, or through `Next on(Context&, const E&)`,
+ *        which may act on the context too. A `void` result stays in the state, and events
+ *        without an overload of `on` are ignored. Optional non-virtual member functions
+ *        `void entry(Context&)` and `void exit(Context&)` are the entry and exit actions,
+ *        which run on every transition, self-transitions included, as with StateMachine.
+ *        Dispatching an event that no state acts upon, nor enters or exits a state with
+ *        actions for, takes a load from the table and a store of the index, unless the
+ *        state machine is observed. Other events go through a table of functions indexed
+ *        by the current state, in which the actions are called directly.
+ * @tparam C  Context policy, see BasicState.
+ * @tparam L  Type list of the states.
+ * @tparam EL Type list of the events.
+ * @tparam O  Observer policy notified around reactions, exit actions, and entry actions.
+ */
+template <typename C, typename L, typename EL, typename O = NullObserver>
+class FlatStateMachine;
+
+template <typename C, typename... TT, typename... EE, typename O>
+class FlatStateMachine<C, TypeList<TT...>, TypeList<EE...>, O>
+    : private detail::ObserverHolder<O> {
+public:
+    /**
+     * @brief Type of the state machine context.
+     */
+    using Context = typename detail::ContextBinding<C>::type;
+
+    /**
+     * @brief Type of the context argument of the constructor, see
+     *        StateMachine::ContextArgument.
+     */
+    using ContextArgument = typename detail::ContextBinding<C>::Argument;
+
+    /**
+     * @brief Observer policy type.
+     */
+    using Observer = O;
+
+    /**
+     * @brief Type able to hold any of the events that the state machine handles.
+     */
+    using Event = std::variant<EE...>;
+
+    /**
+     * @brief Compact identifier of the current state.
+     */
+    using StateIndex =
+        std::conditional_t<(sizeof...(TT) <= UINT8_MAX), std::uint8_t, std::uint16_t>;
+
+    /**
+     * @brief Index of the state type T in the list of states.
+     * @tparam T Concrete type of the state.
+     */
+    template <typename T>
+    static constexpr StateIndex index_of = detail::IndexOf<T, TT...>::value;
+
+    /**
+     * @brief Identifier of the event type E, _i.e._, its index in the list of events.
+     * @tparam E Type of the event.
+     */
+    template <typename E>
+    static constexpr std::size_t event_id = detail::IndexOf<E, EE...>::value;
+
+    static_assert(((std::is_empty_v<TT> && std::is_trivially_copyable_v<TT> &&
+                    std::is_default_constructible_v<TT>) &&
+                   ...),
+                  "Flat states shall be empty, trivially copyable, and default constructible");
+    static_assert((std::is_void_v<typename detail::ParentOf<TT>::type> && ...),
+                  "Flat states shall not be nested");
+
+    /**
+     * @brief Table of the next states, indexed by event identifier, then by state index.
+     */
+    static constexpr std::array<std::array<StateIndex, sizeof...(TT)>, sizeof...(EE)>
+        transitions{{detail::flat_next_states<StateIndex, Context, EE, TT...>()...}};
+
+    /**
+     * @brief Constructs a new state machine object initialized with the input initial state.
+     * @tparam T Concrete type of the initial state.
+     * @param context       State machine context.
+     * @param initial_state Initial state to start from.
+     * @param observer      Observer to notify.
+     */
+    template <typename T>
+    FlatStateMachine(ContextArgument context, T initial_state, Observer observer = Observer{})
+        : detail::ObserverHolder<O>{std::move(observer)},
+          context_{ContextBinding::make(
+              std::forward_as_tuple(std::forward<ContextArgument>(context)))},
+          state_{index_of<T>} {
+        static_cast<void>(initial_state);
+        entry<T>(*this);
+    }
+
+    ~FlatStateMachine() {
+        using Exit = void (*)(FlatStateMachine&);
+        static constexpr Exit exits[] = {&FlatStateMachine::exit<TT>...};
+        exits[state_](*this);
+    }
+
+    FlatStateMachine(const FlatStateMachine& rhs) = delete;
+
+    FlatStateMachine& operator=(const FlatStateMachine& rhs) = delete;
+
+    /**
+     * @brief Dispatches the incoming event.
+     * @tparam E Type of the event to dispatch.
+     * @param e  Event to dispatch.
+     */
+    template <typename E>
+    void dispatch(const E& e) {
+        if constexpr (flat<E>) {
+            static_cast<void>(e);
+            state_ = transitions[event_id<E>][state_];
+        } else {
+            using Thunk = void (*)(FlatStateMachine&, const E&);
+            static constexpr Thunk thunks[] = {&FlatStateMachine::react<TT, E>...};
+            thunks[state_](*this, e);
+        }
+    }
+
+    /**
+     * @brief Dispatches an event held by a std::variant.
+     * @tparam VV Type list of the events that the variant can hold.
+     * @param e   Event to dispatch.
+     */
+    template <typename... VV>
+    void dispatch(const std::variant<VV...>& e) {
+        std::visit([this](const auto& event) { dispatch(event); }, e);
+    }
+
+    /**
+     * @brief Gives access to the observer.
+     * @return Observer& The observer.
+     */
+    Observer& observer() {
+        return detail::ObserverHolder<O>::observer();
+    }
+
+    /**
+     * @brief Gives read-only access to the context.
+     * @return const Context& The state machine context.
+     */
+    const Context& context() const noexcept {
+        return ContextBinding::get(context_);
+    }
+
+    /**
+     * @brief Gives the current state.
+     * @return StateIndex Index of the current state type in the list of states.
+     */
+    StateIndex state_index() const noexcept {
+        return state_;
+    }
+
+    /**
+     * @brief Gives the identifier of the concrete type of the current state.
+     * @return TypeId Identifier of the current state type.
+     */
+    TypeId type_id() const noexcept {
+        static constexpr TypeId ids[] = {unstately::type_id<TT>()...};
+        return ids[state_];
+    }
+
+private:
+    using ContextBinding = detail::ContextBinding<C>;
+
+    template <typename T, typename E>
+    using Reaction = detail::FlatReaction<T, Context, E>;
+
+    // Whether the event E only moves along the table, without calling any action
+    template <typename T, typename E>
+    static constexpr bool inert =
+        !Reaction<T, E>::acts &&
+        (!Reaction<T, E>::transition ||
+         (!detail::HasFlatExit<T, Context>::value &&
+          !detail::HasFlatEntry<typename Reaction<T, E>::Next, Context>::value));
+
+    template <typename E>
+    static constexpr bool flat = std::is_same_v<O, NullObserver> && (inert<TT, E> && ...);
+
+    template <typename T, typename E>
+    static void react(FlatStateMachine& machine, const E& e) {
+        if constexpr (Reaction<T, E>::reacts) {
+            using Next = typename Reaction<T, E>::Next;
+            machine.observer().before_react(unstately::type_id<T>(), event_id<E>);
+            if constexpr (Reaction<T, E>::acts) {
+                T state{};
+                static_cast<void>(state.on(machine.context_ref(), e));
+            }
+            machine.observer().after_react(unstately::type_id<T>(), event_id<E>,
+                                           Reaction<T, E>::transition);
+            if constexpr (Reaction<T, E>::transition) {
+                exit<T>(machine);
+                machine.state_ = index_of<Next>;
+                entry<Next>(machine);
+            }
+        } else {
+            static_cast<void>(machine);
+            static_cast<void>(e);
+        }
+    }
+
+    template <typename T>
+    static void entry(FlatStateMachine& machine) {
+        machine.observer().before_entry(unstately::type_id<T>());
+        if constexpr (detail::HasFlatEntry<T, Context>::value) {
+            T state{};
+            state.entry(machine.context_ref());
+        }
+        detail::notify_after_entry(machine.observer(), unstately::type_id<T>(),
+                                   machine.context_ref());
+    }
+
+    template <typename T>
+    static void exit(FlatStateMachine& machine) {
+        machine.observer().before_exit(unstately::type_id<T>());
+        if constexpr (detail::HasFlatExit<T, Context>::value) {
+            T state{};
+            state.exit(machine.context_ref());
+        }
+        machine.observer().after_exit(unstately::type_id<T>());
+    }
+
+    Context& context_ref() noexcept {
+        return ContextBinding::get(context_);
+    }
+
+    typename ContextBinding::Storage context_{};
+    StateIndex state_{};
+};
+
+} // namespace unstately
+
+#endif // UNSTATELY_FLAT_H_
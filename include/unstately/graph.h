@@ -0,0 +1,282 @@
+/*
+ * Unstately - A very simple state machine implementation in C++
+ *
+ * Copyright (c) 2023 Michele Consonni
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef UNSTATELY_GRAPH_H_
+#define UNSTATELY_GRAPH_H_
+
+#include <array>
+#include <cstddef>
+#include <string_view>
+#include <type_traits>
+
+#include <unstately/unstately.h>
+
+namespace unstately {
+
+namespace detail {
+
+/**
+ * @brief Visits the states reachable from the pending ones, breadth first, and gives the
+ *        list of the visited states.
+ */
+template <typename Visited, typename Pending>
+struct Reach;
+
+template <typename... VV>
+struct Reach<TypeList<VV...>, TypeList<>> {
+    using type = TypeList<VV...>;
+};
+
+template <typename... VV, typename T, typename... PP>
+struct Reach<TypeList<VV...>, TypeList<T, PP...>>
+    : std::conditional_t<
+          (std::is_same_v<T, VV> || ...), Reach<TypeList<VV...>, TypeList<PP...>>,
+          Reach<TypeList<VV..., T>,
+                typename Concat<TypeList<PP...>, typename PermittedTargets<T>::type>::type>> {};
+
+/**
+ * @brief Gives the types listed by L, any instance of a variadic template, that are not
+ *        in the type list R.
+ */
+template <typename L, typename R>
+struct Missing;
+
+template <template <typename...> class F, typename... TT, typename R>
+struct Missing<F<TT...>, R> {
+    using type = typename Concat<
+        std::conditional_t<Contains<TT, R>::value, TypeList<>, TypeList<TT>>...>::type;
+};
+
+/**
+ * @brief Removes the duplicates from the type list L, keeping the first occurrences.
+ */
+template <typename L, typename Kept = TypeList<>>
+struct Unique;
+
+template <typename... KK>
+struct Unique<TypeList<>, TypeList<KK...>> {
+    using type = TypeList<KK...>;
+};
+
+template <typename T, typename... TT, typename... KK>
+struct Unique<TypeList<T, TT...>, TypeList<KK...>>
+    : Unique<TypeList<TT...>, std::conditional_t<(std::is_same_v<T, KK> || ...),
+                                                 TypeList<KK...>, TypeList<KK..., T>>> {};
+
+/**
+ * @brief Gives the arguments of L, any instance of a variadic template.
+ */
+template <typename L>
+struct ArgumentsOf;
+
+template <template <typename...> class F, typename... TT>
+struct ArgumentsOf<F<TT...>> {
+    using type = TypeList<TT...>;
+
+    template <template <typename...> class G, typename... Args>
+    using Apply = G<Args..., TT...>;
+
+    static constexpr std::size_t size = sizeof...(TT);
+};
+
+template <typename... TT>
+constexpr bool declare_targets(TypeList<TT...>) {
+    return (PermittedTargets<TT>::declared && ...);
+}
+
+template <typename T, typename L>
+struct IndexIn;
+
+template <typename T, typename... TT>
+struct IndexIn<T, TypeList<TT...>> : IndexOf<T, TT...> {};
+
+template <typename T, typename = void>
+struct HasName : std::false_type {};
+
+template <typename T>
+struct HasName<T, std::void_t<decltype(std::string_view{T::name})>> : std::true_type {};
+
+/**
+ * @brief Writes text to a buffer, or only counts its characters if there is no buffer.
+ */
+class TextWriter {
+public:
+    constexpr explicit TextWriter(char* buffer) : buffer_{buffer} {}
+
+    constexpr void put(std::string_view text) {
+        for (const char c : text) {
+            if (buffer_ != nullptr) {
+                buffer_[size_] = c;
+            }
+            ++size_;
+        }
+    }
+
+    constexpr void put(std::size_t number) {
+        std::size_t divisor = 1;
+        while (number / divisor >= 10) {
+            divisor *= 10;
+        }
+        for (; divisor > 0; divisor /= 10) {
+            const char digit[] = {static_cast<char>('0' + number / divisor % 10), '\0'};
+            put(std::string_view{digit, 1});
+        }
+    }
+
+    constexpr std::size_t size() const {
+        return size_;
+    }
+
+private:
+    char* buffer_;
+    std::size_t size_{};
+};
+
+} // namespace detail
+
+/**
+ * @brief The graph of the states reachable from an initial state, following the targets
+ *        that states declare as `using Targets = TypeList<...>;`, at compile time.
+ *        States that declare no targets, neither themselves nor through their ancestors,
+ *        are taken as final states: see TransitionGraph::complete.
+ *        The lists it gives are meant for the components that need them once the states
+ *        have been defined, _e.g._, Snapshot or BulkStateMachine, and to check the lists
+ *        given to InlineStateAllocator and VariantStateAllocator, since these are needed
+ *        before.
+ * @tparam T Concrete type of the initial state.
+ */
+template <typename T>
+class TransitionGraph {
+public:
+    /**
+     * @brief List of the reachable states, starting with T, in breadth-first order.
+     */
+    using States = typename detail::Reach<TypeList<>, TypeList<T>>::type;
+
+    /**
+     * @brief Instantiates a variadic template with the reachable states, possibly after
+     *        other arguments, _e.g._, `Apply<Snapshot, Machine>`.
+     * @tparam F Template to instantiate.
+     * @tparam Args Arguments to pass before the reachable states.
+     */
+    template <template <typename...> class F, typename... Args>
+    using Apply = typename detail::ArgumentsOf<States>::template Apply<F, Args...>;
+
+    /**
+     * @brief List of the types given to the variadic template instance L that are not
+     *        reachable, _e.g._, the dead states of `VariantStateAllocator<...>`.
+     * @tparam L Instance of a variadic template.
+     */
+    template <typename L>
+    using Unreachable = typename detail::Missing<L, States>::type;
+
+    /**
+     * @brief List of the reachable states that the variadic template instance L misses.
+     * @tparam L Instance of a variadic template.
+     */
+    template <typename L>
+    using Unlisted =
+        typename detail::Missing<States, typename detail::ArgumentsOf<L>::type>::type;
+
+    /**
+     * @brief Number of reachable states.
+     */
+    static constexpr std::size_t state_count = detail::ArgumentsOf<States>::size;
+
+    /**
+     * @brief Tells whether the state U is reachable.
+     * @tparam U Concrete type of the state.
+     */
+    template <typename U>
+    static constexpr bool reachable = detail::Contains<U, States>::value;
+
+    /**
+     * @brief Tells whether all the reachable states declare their targets, so that the
+     *        graph is known to hold all the possible transitions.
+     */
+    static constexpr bool complete = detail::declare_targets(States{});
+
+    /**
+     * @brief Gives the graph in the DOT language, naming states after their `name` static
+     *        data member if any, after their position in TransitionGraph::States otherwise.
+     *        Since substates inherit the `name` of their parent, they shall declare their own.
+     * @return std::string_view Graph description.
+     */
+    static constexpr std::string_view dot() {
+        return std::string_view{dot_text.data(), dot_text.size()};
+    }
+
+private:
+    template <typename... SS>
+    static constexpr void write(detail::TextWriter& writer, TypeList<SS...>) {
+        writer.put("digraph {\n");
+        (write_state<SS>(writer), ...);
+        writer.put("}\n");
+    }
+
+    template <typename U>
+    static constexpr void write_name(detail::TextWriter& writer) {
+        writer.put("\"");
+        if constexpr (detail::HasName<U>::value) {
+            writer.put(std::string_view{U::name});
+        } else {
+            writer.put("S");
+            writer.put(std::size_t{detail::IndexIn<U, States>::value});
+        }
+        writer.put("\"");
+    }
+
+    template <typename U, typename... VV>
+    static constexpr void write_edges(detail::TextWriter& writer, TypeList<VV...>) {
+        ((writer.put("    "), write_name<U>(writer), writer.put(" -> "),
+          write_name<VV>(writer), writer.put(";\n")),
+         ...);
+    }
+
+    template <typename U>
+    static constexpr void write_state(detail::TextWriter& writer) {
+        writer.put("    ");
+        write_name<U>(writer);
+        writer.put(";\n");
+        using Targets = typename detail::PermittedTargets<U>::type;
+        write_edges<U>(writer, typename detail::Unique<Targets>::type{});
+    }
+
+    static constexpr std::size_t dot_size = [] {
+        detail::TextWriter writer{nullptr};
+        write(writer, States{});
+        return writer.size();
+    }();
+
+    static constexpr std::array<char, dot_size> dot_text = [] {
+        std::array<char, dot_size> text{};
+        detail::TextWriter writer{text.data()};
+        write(writer, States{});
+        return text;
+    }();
+};
+
+} // namespace unstately
+
+#endif // UNSTATELY_GRAPH_H_
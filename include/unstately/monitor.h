@@ -0,0 +1,188 @@
+/*
+ * Unstately - A very simple state machine implementation in C++
+ *
+ * Copyright (c) 2023 Michele Consonni
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef UNSTATELY_MONITOR_H_
+#define UNSTATELY_MONITOR_H_
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <type_traits>
+#include <utility>
+
+#include <unstately/unstately.h>
+
+namespace unstately {
+
+/**
+ * @brief The current state of a state machine, published for other threads, _e.g._,
+ *        metrics and health checks, along with a copy of some fields of its context.
+ *        The dispatching thread publishes through a MonitoringObserver each time a state is
+ *        entered, and any thread may read at any time: the state identifier is read
+ *        wait-free, the fields are read lock-free through a sequence lock, retrying while a
+ *        copy is being published.
+ * @tparam T Trivially copyable type of the published fields, constructible from a
+ *           `const Context&` to select them, or void to publish the state only.
+ */
+template <typename T = void>
+class StateMonitor;
+
+template <>
+class StateMonitor<void> {
+public:
+    StateMonitor() = default;
+
+    StateMonitor(const StateMonitor& rhs) = delete;
+
+    StateMonitor& operator=(const StateMonitor& rhs) = delete;
+
+    /**
+     * @brief Gives the identifier of the last entered state, wait-free. Safe to call from
+     *        any thread.
+     * @return TypeId Identifier of the concrete type of the current state, or an empty one
+     *         if no state has been entered yet.
+     */
+    TypeId state() const noexcept {
+        return state_.load(std::memory_order_acquire);
+    }
+
+    /**
+     * @brief Gives the number of states entered so far, wait-free. Safe to call from any
+     *        thread.
+     * @return std::uint64_t Number of entered states.
+     */
+    std::uint64_t entries() const noexcept {
+        return entries_.load(std::memory_order_acquire);
+    }
+
+    /**
+     * @brief Publishes the entered state. Only the dispatching thread shall call it.
+     * @param id Identifier of the entered state.
+     */
+    void publish(TypeId id) noexcept {
+        state_.store(id, std::memory_order_release);
+        entries_.store(entries_.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+    }
+
+private:
+    // Readers only share the cache line with the dispatching thread when it changes state
+    alignas(detail::cache_line_size) std::atomic<TypeId> state_{};
+    std::atomic<std::uint64_t> entries_{};
+};
+
+template <typename T>
+class StateMonitor : public StateMonitor<void> {
+public:
+    static_assert(std::is_trivially_copyable_v<T>, "Published fields shall be trivially copyable");
+
+    /**
+     * @brief Gives the fields published along with the last entered state, lock-free.
+     *        Safe to call from any thread.
+     * @return T Copy of the fields, or a value-initialized one if no state has been
+     *         entered yet.
+     */
+    T fields() const noexcept {
+        Word words[word_count];
+        for (;;) {
+            const std::uint64_t sequence = sequence_.load(std::memory_order_acquire);
+            // Acquiring the words keeps the sequence from being read again before them
+            for (std::size_t i = 0; i < word_count; ++i) {
+                words[i] = words_[i].load(std::memory_order_acquire);
+            }
+            if ((sequence & 1) == 0 && sequence_.load(std::memory_order_relaxed) == sequence) {
+                break;
+            }
+        }
+        T fields{};
+        std::memcpy(&fields, words, sizeof(T));
+        return fields;
+    }
+
+    /**
+     * @brief Publishes the entered state and the fields selected from the context. Only the
+     *        dispatching thread shall call it.
+     * @param id     Identifier of the entered state.
+     * @param fields Fields to publish.
+     */
+    void publish(TypeId id, const T& fields) noexcept {
+        Word words[word_count]{};
+        std::memcpy(words, &fields, sizeof(T));
+        const std::uint64_t sequence = sequence_.load(std::memory_order_relaxed);
+        sequence_.store(sequence + 1, std::memory_order_relaxed);
+        // Readers that see any of the new words thus see the odd sequence too
+        for (std::size_t i = 0; i < word_count; ++i) {
+            words_[i].store(words[i], std::memory_order_release);
+        }
+        sequence_.store(sequence + 2, std::memory_order_release);
+        StateMonitor<void>::publish(id);
+    }
+
+private:
+    // Copying through atomic words keeps concurrent reads of a torn copy well-defined
+    using Word = std::uintptr_t;
+
+    static constexpr std::size_t word_count = (sizeof(T) + sizeof(Word) - 1) / sizeof(Word);
+
+    std::atomic<std::uint64_t> sequence_{};
+    std::atomic<Word> words_[word_count]{};
+};
+
+/**
+ * @brief Observer that publishes the entered states to a StateMonitor, then notifies the
+ *        application-defined observer. It only acts when the state changes, so that
+ *        dispatching without transitions costs nothing more.
+ * @tparam T Type of the published fields, or void to publish the state only.
+ * @tparam O Application-defined observer policy.
+ */
+template <typename T = void, typename O = NullObserver>
+class MonitoringObserver : public O {
+public:
+    /**
+     * @brief Constructs a new observer publishing to the input monitor.
+     * @param monitor  Monitor to publish to, which shall outlive the state machine.
+     * @param observer Application-defined observer to notify.
+     */
+    explicit MonitoringObserver(StateMonitor<T>& monitor, O observer = O{})
+        : O{std::move(observer)}, monitor_{&monitor} {}
+
+    template <typename C>
+    void after_entry(TypeId id, const C& c) noexcept(
+        (std::is_void_v<T> || std::is_nothrow_constructible_v<T, const C&>) &&
+        detail::nothrow_after_entry<O, C>) {
+        if constexpr (std::is_void_v<T>) {
+            monitor_->publish(id);
+        } else {
+            monitor_->publish(id, T(c));
+        }
+        detail::notify_after_entry(static_cast<O&>(*this), id, c);
+    }
+
+private:
+    StateMonitor<T>* monitor_;
+};
+
+} // namespace unstately
+
+#endif // UNSTATELY_MONITOR_H_
@@ -0,0 +1,318 @@
+/*
+ * Unstately - A very simple state machine implementation in C++
+ *
+ * Copyright (c) 2023 Michele Consonni
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef UNSTATELY_ORTHOGONAL_H_
+#define UNSTATELY_ORTHOGONAL_H_
+
+#include <array>
+#include <cstddef>
+#include <tuple>
+#include <type_traits>
+#include <utility>
+#include <variant>
+
+#include <unstately/unstately.h>
+
+namespace unstately {
+
+namespace detail {
+
+/**
+ * @brief Tells whether the event E is one of the types held by the variant V.
+ */
+template <typename E, typename V>
+struct HoldsEvent;
+
+template <typename E, typename... EE>
+struct HoldsEvent<E, std::variant<EE...>> : std::bool_constant<(std::is_same_v<E, EE> || ...)> {};
+
+/**
+ * @brief The current state of a region, along with the per-region storage of its
+ *        allocation policy, if any.
+ */
+template <typename S>
+class Region : private StorageHolder<typename S::Allocator> {
+public:
+    template <typename T>
+    explicit Region(T&& initial_state)
+        : state{this->template make_state_ptr<T>(std::move(initial_state))} {}
+
+    Region(const Region& rhs) = delete;
+
+    Region& operator=(const Region& rhs) = delete;
+
+    typename S::Ptr state;
+};
+
+} // namespace detail
+
+/**
+ * @brief A state machine made of orthogonal regions, each one in its own state at any time,
+ *        which share a single context. An event is delivered to all the regions whose states
+ *        handle it, in order, within a single call.
+ *        Transitions are committed once all the regions have reacted, so that each region
+ *        reacts to the event in the configuration it was dispatched to: the regions that
+ *        change state are exited in reverse order, then entered in order.
+ *        Regions have no event queues: deferred events are handled right away, and events
+ *        raised by states are discarded. Each region holds its own per-machine storage of
+ *        the allocation policy, if any, and several regions may share the same base class.
+ * @tparam L Type list of the base classes of the states of each region, which shall share
+ *           the same context type.
+ * @tparam O Observer policy notified around reactions, exit actions, and entry actions.
+ */
+template <typename L, typename O = NullObserver>
+class OrthogonalStateMachine;
+
+template <typename... SS, typename O>
+class OrthogonalStateMachine<TypeList<SS...>, O> : private detail::ObserverHolder<O> {
+public:
+    /**
+     * @brief Type of the shared context.
+     */
+    using Context = typename std::tuple_element_t<0, std::tuple<SS...>>::Context;
+
+    /**
+     * @brief Type of the context argument of the constructor, as given by the context policy
+     *        of the first region: see StateMachine::ContextArgument.
+     */
+    using ContextArgument = typename detail::ContextBinding<
+        typename std::tuple_element_t<0, std::tuple<SS...>>::ContextPolicy>::Argument;
+
+    /**
+     * @brief Observer policy type.
+     */
+    using Observer = O;
+
+    /**
+     * @brief Number of regions.
+     */
+    static constexpr std::size_t region_count = sizeof...(SS);
+
+    static_assert((std::is_same_v<typename SS::Context, Context> && ...),
+                  "Regions shall share the same context type");
+
+    /**
+     * @brief Constructs a new state machine object, entering the initial state of each
+     *        region in order.
+     * @tparam TT Concrete types of the initial states, one per region.
+     * @param context        Shared context.
+     * @param initial_states Initial states to start from, _e.g._, as given by
+     *                       std::make_tuple.
+     * @param observer       Observer to notify.
+     */
+    template <typename... TT>
+    OrthogonalStateMachine(ContextArgument context, std::tuple<TT...> initial_states,
+                           Observer observer = Observer{})
+        : OrthogonalStateMachine{std::forward<ContextArgument>(context), std::move(initial_states),
+                                 std::move(observer), std::index_sequence_for<SS...>{}} {}
+
+    ~OrthogonalStateMachine() {
+        exit_all(std::index_sequence_for<SS...>{});
+    }
+
+    OrthogonalStateMachine(const OrthogonalStateMachine& rhs) = delete;
+
+    OrthogonalStateMachine& operator=(const OrthogonalStateMachine& rhs) = delete;
+
+    /**
+     * @brief Dispatches the incoming event to the regions that handle it, then executes the
+     *        transitions that they requested.
+     * @tparam E Type of the event to dispatch.
+     * @param e  Event to dispatch.
+     */
+    template <typename E>
+    void dispatch(const E& e) {
+        static_assert((detail::HoldsEvent<E, typename SS::Event>::value || ...),
+                      "No region handles the event");
+        dispatch(e, std::index_sequence_for<SS...>{});
+    }
+
+    /**
+     * @brief Dispatches an event held by a std::variant.
+     * @tparam EE Type list of the events that the variant can hold.
+     * @param e   Event to dispatch.
+     */
+    template <typename... EE>
+    void dispatch(const std::variant<EE...>& e) {
+        std::visit([this](const auto& event) { dispatch(event); }, e);
+    }
+
+    /**
+     * @brief Gives access to the observer.
+     * @return Observer& The observer.
+     */
+    Observer& observer() {
+        return detail::ObserverHolder<O>::observer();
+    }
+
+    /**
+     * @brief Gives read-only access to the shared context.
+     * @return const Context& The shared context.
+     */
+    const Context& context() const noexcept {
+        return ContextBinding::get(context_);
+    }
+
+    /**
+     * @brief Gives read-only access to the current state of a region.
+     * @tparam I Index of the region.
+     * @return const auto& The current state of the region.
+     */
+    template <std::size_t I>
+    const auto& state() const noexcept {
+        return *std::get<I>(regions_).state;
+    }
+
+private:
+    using ContextBinding = detail::ContextBinding<
+        typename std::tuple_element_t<0, std::tuple<SS...>>::ContextPolicy>;
+
+    template <typename... TT, std::size_t... II>
+    OrthogonalStateMachine(ContextArgument context, std::tuple<TT...>&& initial_states,
+                           Observer&& observer, std::index_sequence<II...>)
+        : detail::ObserverHolder<O>{std::move(observer)},
+          context_{ContextBinding::make(
+              std::forward_as_tuple(std::forward<ContextArgument>(context)))},
+          regions_{std::move(std::get<II>(initial_states))...} {
+        static_assert(sizeof...(TT) == sizeof...(SS), "Regions shall have an initial state");
+        static_assert((std::is_base_of_v<SS, TT> && ...),
+                      "Initial states shall belong to their regions");
+        (bind<II, TT>(), ...);
+        (entry<II>(depth<II>()), ...);
+    }
+
+    template <std::size_t I>
+    using StateOf = std::tuple_element_t<I, std::tuple<SS...>>;
+
+    template <std::size_t I>
+    using StatePtrOf = typename StateOf<I>::Ptr;
+
+    template <std::size_t I, typename T>
+    void bind() {
+        std::get<I>(regions_).state->info_ = &detail::StateDescriptor<StateOf<I>, T>::info;
+    }
+
+    template <std::size_t I>
+    std::size_t depth() const {
+        return std::get<I>(regions_).state->info_->depth;
+    }
+
+    template <typename E, std::size_t... II>
+    void dispatch(const E& e, std::index_sequence<II...>) {
+        // Braced initializers are evaluated in order, hence the regions react in order
+        std::tuple<StatePtrOf<II>...> next_states{react<II>(e)...};
+        if ((std::get<II>(next_states) || ...)) {
+            std::array<detail::TransitionLevels, sizeof...(SS)> levels{
+                transition_levels<II>(std::get<II>(next_states))...};
+            // Folding over the reversed indexes exits the regions from the last one
+            (exit<sizeof...(SS) - 1 - II>(std::get<sizeof...(SS) - 1 - II>(next_states),
+                                          levels[sizeof...(SS) - 1 - II]),
+             ...);
+            (enter<II>(std::move(std::get<II>(next_states)), levels[II]), ...);
+        }
+    }
+
+    template <std::size_t I, typename E>
+    StatePtrOf<I> react(const E& e) {
+        using State = StateOf<I>;
+        if constexpr (!detail::HoldsEvent<E, typename State::Event>::value) {
+            return StatePtrOf<I>{};
+        } else {
+            constexpr std::size_t event_id = State::template event_id<E>;
+            State& state = *std::get<I>(regions_).state;
+            const detail::Disposition disposition = state.info_->dispositions[event_id];
+            if (disposition != detail::Disposition::react &&
+                (disposition == detail::Disposition::ignore || !admits(state, e))) {
+                return StatePtrOf<I>{};
+            }
+            observer().before_react(state.type_id(), event_id);
+            StatePtrOf<I> next_state = state.react(context_ref(), e);
+            observer().after_react(state.type_id(), event_id, static_cast<bool>(next_state));
+            return next_state;
+        }
+    }
+
+    template <typename S, typename E>
+    UNSTATELY_NOINLINE bool admits(const S& state, const E& e) const {
+        return state.passes_filter(ContextBinding::get(context_), e);
+    }
+
+    template <std::size_t I>
+    detail::TransitionLevels transition_levels(const StatePtrOf<I>& next_state) const {
+        if (!next_state) {
+            return {};
+        }
+        const auto& source = *std::get<I>(regions_).state->info_;
+        const auto& target = *next_state->info_;
+        return detail::transition_levels(source.ancestry, source.depth, target.ancestry,
+                                         target.depth);
+    }
+
+    template <std::size_t I>
+    void exit(const StatePtrOf<I>& next_state, detail::TransitionLevels levels) {
+        if (next_state) {
+            exit<I>(levels.exit);
+        }
+    }
+
+    template <std::size_t I>
+    void enter(StatePtrOf<I> next_state, detail::TransitionLevels levels) {
+        if (next_state) {
+            std::get<I>(regions_).state = std::move(next_state);
+            entry<I>(levels.entry);
+        }
+    }
+
+    template <std::size_t I>
+    void entry(std::size_t levels) {
+        auto& state = *std::get<I>(regions_).state;
+        observer().before_entry(state.type_id());
+        state.info_->entry(state, context_ref(), levels);
+        detail::notify_after_entry(observer(), state.type_id(), context_ref());
+    }
+
+    template <std::size_t I>
+    void exit(std::size_t levels) {
+        auto& state = *std::get<I>(regions_).state;
+        observer().before_exit(state.type_id());
+        state.info_->exit(state, context_ref(), levels);
+        observer().after_exit(state.type_id());
+    }
+
+    template <std::size_t... II>
+    void exit_all(std::index_sequence<II...>) {
+        (exit<sizeof...(SS) - 1 - II>(depth<sizeof...(SS) - 1 - II>()), ...);
+    }
+
+    Context& context_ref() noexcept {
+        return ContextBinding::get(context_);
+    }
+
+    typename ContextBinding::Storage context_{};
+    std::tuple<detail::Region<SS>...> regions_;
+};
+
+} // namespace unstately
+
+#endif // UNSTATELY_ORTHOGONAL_H_
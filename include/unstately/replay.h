@@ -0,0 +1,397 @@
+/*
+ * Unstately - A very simple state machine implementation in C++
+ *
+ * Copyright (c) 2023 Michele Consonni
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef UNSTATELY_REPLAY_H_
+#define UNSTATELY_REPLAY_H_
+
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <istream>
+#include <thread>
+#include <type_traits>
+#include <variant>
+#include <vector>
+
+#include <unstately/unstately.h>
+
+namespace unstately {
+
+/**
+ * @brief Progress of the replay of an event log.
+ */
+struct ReplayProgress {
+    //! Number of bytes consumed, _i.e._, of the complete records that have been dispatched.
+    std::size_t consumed;
+    //! Number of events that have been dispatched.
+    std::size_t events;
+    //! Tells whether the replay stopped at a record with an unknown event identifier.
+    bool corrupted;
+};
+
+/**
+ * @brief Encodes events to a compact binary log and replays logs to state machines.
+ *        A log is a versioned header followed by records, each one holding the identifier
+ *        of the event type, on one byte if there are at most 256 event types, and the bytes
+ *        of the event, if it is not empty. Events shall thus be trivially copyable, and
+ *        default constructible to be decoded.
+ *        Records are decoded straight into the event types and dispatched through a table
+ *        indexed by their identifier, without going through std::variant. Runs of records of
+ *        the same event type are decoded into a buffer and dispatched together through the
+ *        `dispatch_all` member function of the state machines that have one.
+ *        Logs use the byte order of the machine that writes them, and need no particular
+ *        alignment, so that they can be read from memory-mapped files. Streamed logs can
+ *        be replayed chunk by chunk, each chunk starting with the bytes left unconsumed by
+ *        the previous one.
+ * @tparam S Base class of the states, which lists the event types.
+ */
+template <typename S>
+class EventLog {
+public:
+    /**
+     * @brief Base class of the states.
+     */
+    using State = S;
+
+    /**
+     * @brief Type able to hold any of the events that the state machines handle.
+     */
+    using Event = typename State::Event;
+
+    /**
+     * @brief Type of the event identifiers stored in the records.
+     */
+    using EventId = std::conditional_t<(State::event_count <= UINT8_MAX + 1), std::uint8_t,
+                                       std::uint16_t>;
+
+    /**
+     * @brief Header at the start of each log.
+     */
+    struct Header {
+        //! Identifies the logs of this library, see EventLog::magic.
+        std::uint32_t magic;
+        //! Version of the log layout, see EventLog::format.
+        std::uint16_t format;
+        //! Number of event types.
+        std::uint16_t event_count;
+        //! Application-defined version of the events.
+        std::uint32_t version;
+        //! Fingerprint of the sizes of the records of each event type.
+        std::uint32_t layout;
+    };
+
+    /**
+     * @brief Value of Header::magic.
+     */
+    static constexpr std::uint32_t magic = 0x4c534e55; // "UNSL" in little endian
+
+    /**
+     * @brief Value of Header::format.
+     */
+    static constexpr std::uint16_t format = 1;
+
+    /**
+     * @brief Size of the record of the event type E.
+     * @tparam E Type of the event.
+     */
+    template <typename E>
+    static constexpr std::size_t record_size =
+        sizeof(EventId) + (std::is_empty_v<E> ? 0 : sizeof(E));
+
+    /**
+     * @brief Writes the header of a new log.
+     * @param log     Buffer of at least `sizeof(Header)` bytes that receives the header.
+     * @param version Application-defined version of the events.
+     */
+    static void write_header(std::byte* log, std::uint32_t version = 0) {
+        const Header header{magic, format, static_cast<std::uint16_t>(State::event_count),
+                            version, Layout<Event>::value};
+        std::memcpy(log, &header, sizeof(Header));
+    }
+
+    /**
+     * @brief Tells whether a log starts with a valid header.
+     * @param log     Log to check, which needs no particular alignment.
+     * @param length  Number of bytes available from the start of the log.
+     * @param version Application-defined version that the log shall match.
+     * @return true if the header is valid.
+     */
+    static bool check_header(const std::byte* log, std::size_t length, std::uint32_t version = 0) {
+        Header header{};
+        if (length < sizeof(Header)) {
+            return false;
+        }
+        std::memcpy(&header, log, sizeof(Header));
+        return header.magic == magic && header.format == format &&
+               header.event_count == State::event_count && header.version == version &&
+               header.layout == Layout<Event>::value;
+    }
+
+    /**
+     * @brief Encodes an event into a record.
+     * @tparam E Type of the event to encode.
+     * @param e      Event to encode.
+     * @param record Buffer of at least EventLog::record_size<E> bytes that receives it.
+     * @return std::size_t Size of the record.
+     */
+    template <typename E>
+    static std::size_t encode(const E& e, std::byte* record) {
+        const auto id = static_cast<EventId>(State::template event_id<E>);
+        std::memcpy(record, &id, sizeof(EventId));
+        if constexpr (!std::is_empty_v<E>) {
+            std::memcpy(record + sizeof(EventId), &e, sizeof(E));
+        }
+        return record_size<E>;
+    }
+
+    /**
+     * @brief Appends the header, if the log is empty, and then the record of an event.
+     * @tparam E Type of the event to append, possibly a std::variant.
+     * @param log     Log to append to.
+     * @param e       Event to append.
+     * @param version Application-defined version of the events, written to a new header.
+     */
+    template <typename E>
+    static void append(std::vector<std::byte>& log, const E& e, std::uint32_t version = 0) {
+        if (log.empty()) {
+            log.resize(sizeof(Header));
+            write_header(log.data(), version);
+        }
+        if constexpr (detail::IsVariant<E>::value) {
+            std::visit([&log](const auto& event) { append(log, event); }, e);
+        } else {
+            const std::size_t size = log.size();
+            log.resize(size + record_size<E>);
+            encode(e, log.data() + size);
+        }
+    }
+
+    /**
+     * @brief Dispatches the events of the complete records of a log, in order, stopping at
+     *        the first incomplete or corrupted one.
+     * @tparam M Type of the state machine.
+     * @param machine State machine to dispatch to.
+     * @param records Records to replay, without the header, needing no particular alignment.
+     * @param length  Number of bytes available from the first record.
+     * @return ReplayProgress Number of bytes consumed and of events dispatched.
+     */
+    template <typename M>
+    static ReplayProgress replay(M& machine, const std::byte* records, std::size_t length) {
+        return Decoder<M, Event>::replay(machine, records, length);
+    }
+
+    /**
+     * @brief Replays a streamed log, header included, reading it chunk by chunk.
+     * @tparam M Type of the state machine.
+     * @param machine State machine to dispatch to.
+     * @param stream  Stream to read the log from.
+     * @param version Application-defined version that the log shall match.
+     * @return ReplayProgress Number of bytes consumed after the header and of events
+     *         dispatched, corrupted if the header is not valid either.
+     */
+    template <typename M>
+    static ReplayProgress replay(M& machine, std::istream& stream, std::uint32_t version = 0) {
+        std::byte header[sizeof(Header)];
+        if (!stream.read(reinterpret_cast<char*>(header), sizeof(Header)) ||
+            !check_header(header, sizeof(Header), version)) {
+            return {0, 0, true};
+        }
+        ReplayProgress total{0, 0, false};
+        std::vector<std::byte> chunk(chunk_size);
+        std::size_t kept = 0;
+        while (!total.corrupted && stream) {
+            stream.read(reinterpret_cast<char*>(chunk.data() + kept),
+                        static_cast<std::streamsize>(chunk_size - kept));
+            const std::size_t length = kept + static_cast<std::size_t>(stream.gcount());
+            const ReplayProgress progress = replay(machine, chunk.data(), length);
+            total.consumed += progress.consumed;
+            total.events += progress.events;
+            total.corrupted = progress.corrupted;
+            kept = length - progress.consumed;
+            std::memmove(chunk.data(), chunk.data() + progress.consumed, kept);
+        }
+        return total;
+    }
+
+    /**
+     * @brief The replay of the log of one state machine, run by EventLog::replay_parallel.
+     * @tparam M Type of the state machine.
+     */
+    template <typename M>
+    struct Job {
+        //! State machine to dispatch to.
+        M* machine;
+        //! Log to replay, header included.
+        const std::byte* log;
+        //! Number of bytes of the log.
+        std::size_t length;
+        //! Receives the progress of the replay, corrupted if the header is not valid either.
+        ReplayProgress progress;
+    };
+
+    /**
+     * @brief Replays the logs of many independent state machines on a pool of threads,
+     *        each log being replayed by a single thread. Threads take the next job once done
+     *        with the previous one, so that long logs do not hold back the short ones.
+     * @tparam M Type of the state machines.
+     * @param jobs    Jobs to run, which receive their progress.
+     * @param count   Number of jobs.
+     * @param threads Number of threads, including the calling one.
+     * @param version Application-defined version that the logs shall match.
+     */
+    template <typename M>
+    static void replay_parallel(Job<M>* jobs, std::size_t count,
+                                std::size_t threads = std::thread::hardware_concurrency(),
+                                std::uint32_t version = 0) {
+        if (count == 0) {
+            return;
+        }
+        std::atomic<std::size_t> next{0};
+        const auto work = [jobs, count, version, &next] {
+            for (std::size_t i = next++; i < count; i = next++) {
+                Job<M>& job = jobs[i];
+                if (!check_header(job.log, job.length, version)) {
+                    job.progress = {0, 0, true};
+                } else {
+                    job.progress = replay(*job.machine, job.log + sizeof(Header),
+                                          job.length - sizeof(Header));
+                }
+            }
+        };
+        std::vector<std::thread> pool;
+        const std::size_t helpers = std::min(std::max<std::size_t>(threads, 1), count) - 1;
+        pool.reserve(helpers);
+        for (std::size_t i = 0; i < helpers; ++i) {
+            pool.emplace_back(work);
+        }
+        work();
+        for (auto& thread : pool) {
+            thread.join();
+        }
+    }
+
+private:
+    static constexpr std::size_t chunk_size = 64 * 1024;
+
+    template <typename V>
+    struct Layout;
+
+    // FNV-1a hash of the record sizes
+    template <typename... EE>
+    struct Layout<std::variant<EE...>> {
+        static_assert((std::is_trivially_copyable_v<EE> && ...),
+                      "Logged events shall be trivially copyable");
+
+        static constexpr std::uint32_t value = [] {
+            std::uint32_t hash = 2166136261U;
+            for (const std::size_t size : {record_size<EE>...}) {
+                hash = (hash ^ static_cast<std::uint32_t>(size)) * 16777619U;
+            }
+            return hash;
+        }();
+    };
+
+    // Maximum number of events of a run dispatched at once
+    static constexpr std::size_t run_capacity = 64;
+
+    template <typename M, typename E, typename = void>
+    struct DispatchesAll : std::false_type {};
+
+    template <typename M, typename E>
+    struct DispatchesAll<M, E,
+                         std::void_t<decltype(std::declval<M&>().dispatch_all(
+                             std::declval<const E*>(), std::declval<const E*>()))>>
+        : std::true_type {};
+
+    template <typename M, typename V>
+    struct Decoder;
+
+    template <typename M, typename... EE>
+    struct Decoder<M, std::variant<EE...>> {
+        template <typename E>
+        static void decode(E& e, const std::byte* record) {
+            if constexpr (!std::is_empty_v<E>) {
+                std::memcpy(static_cast<void*>(&e), record + sizeof(EventId), sizeof(E));
+            }
+        }
+
+        // Dispatches the run of complete records of type E starting at the input one, and
+        // returns the number of records dispatched
+        template <typename E>
+        static std::size_t dispatch_run(M& machine, const std::byte* record, std::size_t length) {
+            std::size_t count = 1;
+            if constexpr (DispatchesAll<M, E>::value) {
+                constexpr auto id = static_cast<EventId>(State::template event_id<E>);
+                for (; count < run_capacity && length >= (count + 1) * record_size<E>; ++count) {
+                    EventId next{};
+                    std::memcpy(&next, record + count * record_size<E>, sizeof(EventId));
+                    if (next != id) {
+                        break;
+                    }
+                }
+            }
+            if (count == 1) {
+                E e{};
+                decode(e, record);
+                machine.dispatch(e);
+            } else if constexpr (DispatchesAll<M, E>::value) {
+                E run[run_capacity];
+                for (std::size_t i = 0; i < count; ++i) {
+                    decode(run[i], record + i * record_size<E>);
+                }
+                machine.dispatch_all(run + 0, run + count);
+            }
+            return count;
+        }
+
+        static ReplayProgress replay(M& machine, const std::byte* records, std::size_t length) {
+            using Thunk = std::size_t (*)(M&, const std::byte*, std::size_t);
+            static constexpr Thunk thunks[] = {&dispatch_run<EE>...};
+            static constexpr std::size_t sizes[] = {record_size<EE>...};
+            ReplayProgress progress{0, 0, false};
+            while (length - progress.consumed >= sizeof(EventId)) {
+                const std::byte* record = records + progress.consumed;
+                EventId id{};
+                std::memcpy(&id, record, sizeof(EventId));
+                if (id >= sizeof...(EE)) {
+                    progress.corrupted = true;
+                    break;
+                }
+                if (length - progress.consumed < sizes[id]) {
+                    break;
+                }
+                const std::size_t count = thunks[id](machine, record, length - progress.consumed);
+                progress.consumed += count * sizes[id];
+                progress.events += count;
+            }
+            return progress;
+        }
+    };
+};
+
+} // namespace unstately
+
+#endif // UNSTATELY_REPLAY_H_
@@ -0,0 +1,261 @@
+/*
+ * Unstately - A very simple state machine implementation in C++
+ *
+ * Copyright (c) 2023 Michele Consonni
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef UNSTATELY_SNAPSHOT_H_
+#define UNSTATELY_SNAPSHOT_H_
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <new>
+#include <optional>
+#include <type_traits>
+#include <utility>
+
+#include <unstately/unstately.h>
+
+namespace unstately {
+
+namespace detail {
+
+/**
+ * @brief Gives the type of the data that the state T saves in snapshots, _i.e._, the type
+ *        returned by its save member function, or void if T saves no data.
+ */
+template <typename T, typename = void>
+struct SavedData {
+    using type = void;
+};
+
+template <typename T>
+struct SavedData<T, std::void_t<decltype(std::declval<const T&>().save())>> {
+    using type = decltype(std::declval<const T&>().save());
+};
+
+template <typename T>
+constexpr std::size_t saved_size = [] {
+    if constexpr (std::is_void_v<typename SavedData<T>::type>) {
+        return std::size_t{0};
+    } else {
+        return sizeof(typename SavedData<T>::type);
+    }
+}();
+
+template <typename T>
+constexpr std::size_t saved_alignment = [] {
+    if constexpr (std::is_void_v<typename SavedData<T>::type>) {
+        return std::size_t{1};
+    } else {
+        return alignof(typename SavedData<T>::type);
+    }
+}();
+
+constexpr std::size_t align_up(std::size_t size, std::size_t alignment) {
+    return (size + alignment - 1) / alignment * alignment;
+}
+
+/**
+ * @brief Copies a trivially copyable object out of a record, which needs no particular
+ *        alignment, without requiring its type to be default constructible.
+ */
+template <typename T>
+T load(const std::byte* bytes) {
+    alignas(T) std::byte storage[sizeof(T)];
+    std::memcpy(storage, bytes, sizeof(T));
+    return *std::launder(reinterpret_cast<const T*>(storage));
+}
+
+} // namespace detail
+
+/**
+ * @brief Saves state machines to fixed-size binary records and restores them.
+ *        A record holds a versioned header, the context, and the data of the current state.
+ *        The context shall be trivially copyable. The data of a state is the trivially
+ *        copyable value returned by its `save() const` member function, from which the state
+ *        is constructed back. States without such a function save no data and are default
+ *        constructed back.
+ *        Records use the byte order of the machine that saves them. Queued events, if any,
+ *        are not saved.
+ *        Since all the records of a machine type share the same size and alignment, a fleet
+ *        can be saved as an array of records, _e.g._, in a memory-mapped file, and each
+ *        machine restored from its record without decoding the other ones.
+ * @tparam M Type of the state machine, _e.g._, StateMachine or VariantStateMachine.
+ * @tparam TT Type list of the concrete states that the state machine may be in.
+ */
+template <typename M, typename... TT>
+class Snapshot {
+public:
+    /**
+     * @brief Type of the state machine.
+     */
+    using Machine = M;
+
+    /**
+     * @brief Type of the state machine context.
+     */
+    using Context = typename Machine::Context;
+
+    /**
+     * @brief Observer policy type.
+     */
+    using Observer = typename Machine::Observer;
+
+    static_assert(std::is_trivially_copyable_v<Context>, "Context shall be trivially copyable");
+    static_assert(std::is_same_v<typename Machine::ContextArgument, Context&&>,
+                  "State machines shall own their context to be snapshotted");
+    static_assert(((std::is_void_v<typename detail::SavedData<TT>::type> ||
+                    std::is_trivially_copyable_v<typename detail::SavedData<TT>::type>) &&
+                   ...),
+                  "Saved state data shall be trivially copyable");
+
+    /**
+     * @brief Header at the start of each record.
+     */
+    struct Header {
+        //! Identifies the records of this library, see Snapshot::magic.
+        std::uint32_t magic;
+        //! Version of the record layout, see Snapshot::format.
+        std::uint16_t format;
+        //! Index of the current state in the type list TT.
+        std::uint16_t state;
+        //! Application-defined version of the context and of the saved state data.
+        std::uint32_t version;
+        //! Size of the record, see Snapshot::size.
+        std::uint32_t size;
+    };
+
+    /**
+     * @brief Value of Header::magic.
+     */
+    static constexpr std::uint32_t magic = 0x54534e55; // "UNST" in little endian
+
+    /**
+     * @brief Value of Header::format.
+     */
+    static constexpr std::uint16_t format = 1;
+
+    /**
+     * @brief Alignment of the records.
+     */
+    static constexpr std::size_t alignment =
+        std::max({alignof(Header), alignof(Context), detail::saved_alignment<TT>...});
+
+    /**
+     * @brief Size of the records.
+     */
+    static constexpr std::size_t size = detail::align_up(
+        detail::align_up(detail::align_up(sizeof(Header), alignof(Context)) + sizeof(Context),
+                         std::max({detail::saved_alignment<TT>...})) +
+            std::max({detail::saved_size<TT>...}),
+        alignment);
+
+    /**
+     * @brief Saves a state machine.
+     * @param machine State machine to save.
+     * @param record  Buffer of at least Snapshot::size bytes that receives the record.
+     * @param version Application-defined version of the context and of the saved data.
+     * @return true if the machine has been saved, false if its current state is not listed
+     *         in TT.
+     */
+    static bool save(const Machine& machine, std::byte* record, std::uint32_t version = 0) {
+        static constexpr TypeId ids[] = {type_id<TT>()...};
+        const auto found = std::find(std::begin(ids), std::end(ids), machine.state().type_id());
+        if (found == std::end(ids)) {
+            return false;
+        }
+        const auto state = static_cast<std::uint16_t>(found - std::begin(ids));
+        const Header header{magic, format, state, version, static_cast<std::uint32_t>(size)};
+        // Clear the padding too, so that equal machines give equal records
+        std::memset(record, 0, size);
+        std::memcpy(record, &header, sizeof(Header));
+        std::memcpy(record + context_offset, &machine.context(), sizeof(Context));
+        using Saver = void (*)(const typename Machine::State&, std::byte*);
+        static constexpr Saver savers[] = {&save_data<TT>...};
+        savers[state](machine.state(), record + data_offset);
+        return true;
+    }
+
+    /**
+     * @brief Restores a state machine from a record. Its context is copied from the saved
+     *        one, and its current state is constructed back from the saved data, but its entry
+     *        actions are not executed again. Neither the context nor the saved data need be
+     *        default constructible.
+     * @param machine  Receives the restored state machine.
+     * @param record   Record to restore from, which needs no particular alignment.
+     * @param length   Number of bytes available from the start of the record.
+     * @param version  Application-defined version that the record shall match.
+     * @param observer Observer to notify.
+     * @return true if the machine has been restored, false if the record is not valid.
+     */
+    static bool restore(std::optional<Machine>& machine, const std::byte* record,
+                        std::size_t length, std::uint32_t version = 0,
+                        Observer observer = Observer{}) {
+        Header header{};
+        if (length < size) {
+            return false;
+        }
+        std::memcpy(&header, record, sizeof(Header));
+        if (header.magic != magic || header.format != format || header.version != version ||
+            header.size != size || header.state >= sizeof...(TT)) {
+            return false;
+        }
+        using Restorer = void (*)(std::optional<Machine>&, const std::byte*, Observer&&);
+        static constexpr Restorer restorers[] = {&restore_state<TT>...};
+        restorers[header.state](machine, record, std::move(observer));
+        return true;
+    }
+
+private:
+    static constexpr std::size_t context_offset =
+        detail::align_up(sizeof(Header), alignof(Context));
+
+    static constexpr std::size_t data_offset = detail::align_up(
+        context_offset + sizeof(Context), std::max({detail::saved_alignment<TT>...}));
+
+    template <typename T>
+    static void save_data(const typename Machine::State& state, std::byte* data) {
+        if constexpr (!std::is_void_v<typename detail::SavedData<T>::type>) {
+            const auto saved = static_cast<const T&>(state).save();
+            std::memcpy(data, &saved, sizeof(saved));
+        }
+    }
+
+    template <typename T>
+    static void restore_state(std::optional<Machine>& machine, const std::byte* record,
+                              Observer&& observer) {
+        Context context = detail::load<Context>(record + context_offset);
+        if constexpr (std::is_void_v<typename detail::SavedData<T>::type>) {
+            machine.emplace(resume, std::move(context), T{}, std::move(observer));
+        } else {
+            using Saved = typename detail::SavedData<T>::type;
+            const Saved saved = detail::load<Saved>(record + data_offset);
+            machine.emplace(resume, std::move(context), T(saved), std::move(observer));
+        }
+    }
+};
+
+} // namespace unstately
+
+#endif // UNSTATELY_SNAPSHOT_H_
@@ -0,0 +1,362 @@
+/*
+ * Unstately - A very simple state machine implementation in C++
+ *
+ * Copyright (c) 2023 Michele Consonni
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef UNSTATELY_TIMER_H_
+#define UNSTATELY_TIMER_H_
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <type_traits>
+#include <utility>
+
+#include <unstately/unstately.h>
+
+namespace unstately {
+
+class TimerWheel;
+
+/**
+ * @brief A timer that a TimerWheel links into its slots, without allocating.
+ *        It is cancelled when destroyed, and is thus neither copyable nor movable.
+ */
+class Timer {
+public:
+    /**
+     * @brief Constructs a new timer that is not armed.
+     * @param expire Function called with the input owner when the timer expires.
+     * @param owner  Pointer passed to the function.
+     */
+    Timer(void (*expire)(void*), void* owner) noexcept : expire_{expire}, owner_{owner} {}
+
+    ~Timer() {
+        cancel();
+    }
+
+    Timer(const Timer& rhs) = delete;
+
+    Timer& operator=(const Timer& rhs) = delete;
+
+    /**
+     * @brief Tells whether the timer is armed.
+     * @return true if the timer is armed.
+     */
+    bool armed() const noexcept {
+        return next_ != nullptr;
+    }
+
+    /**
+     * @brief Disarms the timer, if armed, in constant time.
+     */
+    void cancel() noexcept {
+        if (next_) {
+            prev_->next_ = next_;
+            next_->prev_ = prev_;
+            prev_ = nullptr;
+            next_ = nullptr;
+        }
+    }
+
+private:
+    friend class TimerWheel;
+
+    Timer() noexcept : prev_{this}, next_{this} {}
+
+    // Links the timer before the input one, i.e., at the back of the list it heads
+    void link_before(Timer& head) noexcept {
+        prev_ = head.prev_;
+        next_ = &head;
+        head.prev_->next_ = this;
+        head.prev_ = this;
+    }
+
+    Timer* prev_{};
+    Timer* next_{};
+    std::uint64_t expiry_{};
+    void (*expire_)(void*){};
+    void* owner_{};
+};
+
+/**
+ * @brief A hierarchical timer wheel shared by many timers. Each of its four levels has 256
+ *        slots, each spanning 256 times as many ticks as those of the level below: arming
+ *        and cancelling a timer take constant time, while advancing moves the timers that
+ *        get closer to their expiry down one level at a time.
+ *        The unit of the ticks is up to the application, which advances the wheel.
+ */
+class TimerWheel {
+public:
+    /**
+     * @brief Longest delay, in ticks, that a timer can be armed with.
+     */
+    static constexpr std::uint64_t max_delay = (std::uint64_t{1} << 32) - 1;
+
+    TimerWheel() = default;
+
+    TimerWheel(const TimerWheel& rhs) = delete;
+
+    TimerWheel& operator=(const TimerWheel& rhs) = delete;
+
+    /**
+     * @brief Gives the number of ticks elapsed since the construction.
+     * @return std::uint64_t Current tick.
+     */
+    std::uint64_t now() const noexcept {
+        return now_;
+    }
+
+    /**
+     * @brief Arms a timer, or re-arms it if armed already, in constant time.
+     * @param timer Timer to arm, which shall outlive neither this wheel nor its arming.
+     * @param delay Number of ticks before the timer expires, at least one and at most
+     *              TimerWheel::max_delay.
+     */
+    void schedule(Timer& timer, std::uint64_t delay) noexcept {
+        timer.cancel();
+        timer.expiry_ = now_ + std::clamp<std::uint64_t>(delay, 1, max_delay);
+        insert(timer);
+    }
+
+    /**
+     * @brief Advances the wheel, tick by tick, calling the expiry functions of the timers
+     *        that expire. Those may arm and cancel timers.
+     * @param ticks Number of ticks to advance.
+     */
+    void advance(std::uint64_t ticks = 1) {
+        for (; ticks > 0; --ticks) {
+            tick();
+        }
+    }
+
+private:
+    static constexpr unsigned bits = 8;
+    static constexpr unsigned levels = 4;
+    static constexpr std::size_t slots = std::size_t{1} << bits;
+
+    static_assert(max_delay >> (bits * levels) == 0, "Delays shall fit the levels");
+
+    static std::size_t slot(std::uint64_t tick, unsigned level) noexcept {
+        return static_cast<std::size_t>(tick >> (bits * level)) & (slots - 1);
+    }
+
+    // Timers that expire now or earlier go into the current slot of the lowest level
+    void insert(Timer& timer) noexcept {
+        const std::uint64_t delay = timer.expiry_ > now_ ? timer.expiry_ - now_ : 0;
+        unsigned level = 0;
+        while (level + 1 < levels && delay >> (bits * (level + 1)) != 0) {
+            ++level;
+        }
+        const std::uint64_t expiry = std::max(timer.expiry_, now_);
+        timer.link_before(wheel_[level][slot(expiry, level)]);
+    }
+
+    void tick() {
+        ++now_;
+        // The slots of the upper levels whose span starts now move down, highest first
+        unsigned top = 0;
+        while (top + 1 < levels && slot(now_, top) == 0) {
+            ++top;
+        }
+        for (unsigned level = top; level > 0; --level) {
+            Timer& head = wheel_[level][slot(now_, level)];
+            while (head.next_ != &head) {
+                Timer& timer = *head.next_;
+                timer.cancel();
+                insert(timer);
+            }
+        }
+        // Expiry functions may arm timers in this slot again, for a later round
+        Timer expired{};
+        Timer& head = wheel_[0][slot(now_, 0)];
+        if (head.next_ != &head) {
+            expired.prev_ = head.prev_;
+            expired.next_ = head.next_;
+            head.prev_->next_ = &expired;
+            head.next_->prev_ = &expired;
+            head.prev_ = &head;
+            head.next_ = &head;
+        }
+        while (expired.next_ != &expired) {
+            Timer& timer = *expired.next_;
+            timer.cancel();
+            timer.expire_(timer.owner_);
+        }
+        expired.prev_ = nullptr;
+        expired.next_ = nullptr;
+    }
+
+    Timer wheel_[levels][slots]{};
+    std::uint64_t now_{};
+};
+
+/**
+ * @brief The event that TimedStateMachine dispatches when the timeout of the current state
+ *        expires. States using timeouts shall list it among the events that they handle.
+ */
+struct Timeout {};
+
+namespace detail {
+
+/**
+ * @brief Observer that arms the timer of a TimedStateMachine after entering a state and
+ *        cancels it before exiting it, then notifies the application-defined observer.
+ */
+template <typename W, typename O>
+class TimeoutObserver : public O {
+public:
+    TimeoutObserver(W* owner, O observer) : O{std::move(observer)}, owner_{owner} {}
+
+    void before_exit(TypeId id) noexcept(noexcept(O::before_exit(id))) {
+        owner_->timer_.cancel();
+        O::before_exit(id);
+    }
+
+    template <typename C>
+    void after_entry(TypeId id, const C& c) noexcept(nothrow_after_entry<O, C>) {
+        owner_->arm();
+        notify_after_entry(static_cast<O&>(*this), id, c);
+    }
+
+private:
+    W* owner_;
+};
+
+} // namespace detail
+
+/**
+ * @brief A state machine whose states may time out. A state declares its timeout, in
+ *        ticks of the shared TimerWheel, as `static constexpr std::uint64_t timeout = ...;`.
+ *        The timer is armed each time the state is entered and cancelled when it is
+ *        exited, and its expiry dispatches a Timeout event like any other event.
+ *        Timeouts are resolved at compile time for each concrete state type, and read from
+ *        the entered state without any lookup: those of the listed states are checked
+ *        against TimerWheel::max_delay, while those of any other state are clamped to it.
+ *        Since the wheel calls back into the state machine, it shall not be advanced from
+ *        within handlers.
+ * @tparam S Base class of the states that this state machine can handle.
+ * @tparam L Type list of the concrete states that may time out, whose timeouts are checked
+ *           at compile time, _e.g._, TransitionGraph::States.
+ * @tparam O Observer policy notified around reactions, exit actions, and entry actions.
+ * @tparam N Capacity of each event queue of the wrapped StateMachine, or zero.
+ */
+template <typename S, typename L, typename O = NullObserver, std::size_t N = 0>
+class TimedStateMachine;
+
+template <typename S, typename... TT, typename O, std::size_t N>
+class TimedStateMachine<S, TypeList<TT...>, O, N> {
+public:
+    /**
+     * @brief Observer policy type.
+     */
+    using Observer = O;
+
+    /**
+     * @brief Type of the wrapped state machine.
+     */
+    using Machine = StateMachine<S, detail::TimeoutObserver<TimedStateMachine, O>, N>;
+
+    /**
+     * @brief Base class of the states.
+     */
+    using State = S;
+
+    /**
+     * @brief Type of the state machine context.
+     */
+    using Context = typename State::Context;
+
+    /**
+     * @brief Constructs a new state machine object initialized with the input initial state,
+     *        arming its timeout if any.
+     * @tparam T Concrete type of the initial state.
+     * @param wheel         Timer wheel shared with other state machines, which shall
+     *                      outlive this one.
+     * @param context       State machine context.
+     * @param initial_state Initial state to start from.
+     * @param observer      Observer to notify.
+     */
+    template <typename T>
+    TimedStateMachine(TimerWheel& wheel, typename Machine::ContextArgument context,
+                      T&& initial_state, Observer observer = Observer{})
+        : wheel_{wheel},
+          machine_{std::forward<typename Machine::ContextArgument>(context),
+                   std::move(initial_state),
+                   detail::TimeoutObserver<TimedStateMachine, O>{this, std::move(observer)}} {}
+
+    TimedStateMachine(const TimedStateMachine& rhs) = delete;
+
+    TimedStateMachine& operator=(const TimedStateMachine& rhs) = delete;
+
+    /**
+     * @brief Dispatches the incoming event.
+     * @tparam E Type of the event to dispatch.
+     * @param e  Event to dispatch.
+     */
+    template <typename E>
+    void dispatch(const E& e) {
+        machine_.dispatch(e);
+    }
+
+    /**
+     * @brief Tells whether the timeout of the current state is armed.
+     * @return true if the timeout is armed.
+     */
+    bool armed() const noexcept {
+        return timer_.armed();
+    }
+
+    /**
+     * @brief Gives access to the wrapped state machine.
+     * @return Machine& The wrapped state machine.
+     */
+    Machine& machine() noexcept {
+        return machine_;
+    }
+
+private:
+    friend class detail::TimeoutObserver<TimedStateMachine, O>;
+
+    static_assert(((detail::TimeoutOf<TT>::value <= TimerWheel::max_delay) && ...),
+                  "State timeout exceeds TimerWheel::max_delay");
+
+    // The machine transitions directly, so the entered state is the current one already
+    void arm() noexcept {
+        const std::uint64_t timeout = machine_.state().info_->timeout;
+        if (timeout > 0) {
+            wheel_.schedule(timer_, timeout);
+        }
+    }
+
+    static void expire(void* owner) {
+        static_cast<TimedStateMachine*>(owner)->machine_.dispatch(Timeout{});
+    }
+
+    TimerWheel& wheel_;
+    Timer timer_{&TimedStateMachine::expire, this};
+    Machine machine_;
+};
+
+} // namespace unstately
+
+#endif // UNSTATELY_TIMER_H_
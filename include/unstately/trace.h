@@ -0,0 +1,247 @@
+/*
+ * Unstately - A very simple state machine implementation in C++
+ *
+ * Copyright (c) 2023 Michele Consonni
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef UNSTATELY_TRACE_H_
+#define UNSTATELY_TRACE_H_
+
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <utility>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#elif defined(_M_X64) || defined(_M_IX86)
+#include <intrin.h>
+#endif
+
+#include <unstately/unstately.h>
+
+namespace unstately {
+
+/**
+ * @brief Default clock of the trace rings: the time-stamp counter of the processor where
+ *        available, which is read in a few cycles, or std::chrono::steady_clock otherwise.
+ *        Application-defined clocks shall provide the same static member function.
+ */
+struct TraceClock {
+    static std::uint64_t now() noexcept {
+#if defined(__x86_64__) || defined(__i386__) || defined(_M_X64) || defined(_M_IX86)
+        return __rdtsc();
+#else
+        return static_cast<std::uint64_t>(
+            std::chrono::steady_clock::now().time_since_epoch().count());
+#endif
+    }
+};
+
+/**
+ * @brief A record of a trace ring: the reaction of a state to an event, along with the
+ *        state it transitioned to, or the entry of an initial state.
+ */
+struct TraceRecord {
+    /**
+     * @brief Value of TraceRecord::event for the entry of an initial state.
+     */
+    static constexpr std::uint32_t no_event = UINT32_MAX;
+
+    //! Time of the reaction, in ticks of the clock of the ring.
+    std::uint64_t time;
+    //! Identifier of the state that reacted, or an empty one for an initial state.
+    TypeId from;
+    //! Identifier of the state entered, or an empty one if the state did not change.
+    //! Records of transitions whose target was not recorded, _e.g._, interrupted while
+    //! exiting, hold `type_id<TraceRecord>()`.
+    TypeId to;
+    //! Identifier of the event, see State::event_id, or TraceRecord::no_event.
+    std::uint32_t event;
+};
+
+/**
+ * @brief A fixed-size ring of the last reactions of one or many state machines, recorded by
+ *        a TracingObserver, for post-mortem inspection. Recording takes a read of the clock
+ *        and a few stores, without locks: the ring shall thus only be recorded to from a
+ *        single thread, _e.g._, with one ring per state machine or a `thread_local` one
+ *        shared by the state machines of a thread.
+ *        The ring can be dumped on demand from the recording thread, once it stopped
+ *        recording, or from a crash handler, which may find the last record incomplete.
+ * @tparam N     Number of records, which shall be a power of two.
+ * @tparam Clock Clock providing the timestamps, see TraceClock.
+ */
+template <std::size_t N = 256, typename Clock = TraceClock>
+class TraceRing {
+public:
+    static_assert(N > 0 && (N & (N - 1)) == 0, "Trace rings shall hold a power of two records");
+
+    /**
+     * @brief Number of records held by the ring.
+     */
+    static constexpr std::size_t capacity = N;
+
+    TraceRing() = default;
+
+    TraceRing(const TraceRing& rhs) = delete;
+
+    TraceRing& operator=(const TraceRing& rhs) = delete;
+
+    /**
+     * @brief Gives the number of records written so far, including those overwritten.
+     * @return std::uint64_t Number of written records.
+     */
+    std::uint64_t recorded() const noexcept {
+        return recorded_;
+    }
+
+    /**
+     * @brief Records the reaction of a state to an event. A transition still pending, see
+     *        TraceRing::record_entry, is abandoned: its target is never recorded.
+     * @param from       Identifier of the state that reacted.
+     * @param event      Identifier of the event.
+     * @param transition Whether the state requested a transition, whose target is then
+     *                   recorded by the next call to TraceRing::record_entry.
+     */
+    void record_reaction(TypeId from, std::uint32_t event, bool transition) noexcept {
+        pending_ = transition ? recorded_ : none;
+        write(from, event, transition ? unrecorded : TypeId{});
+    }
+
+    /**
+     * @brief Records the reaction of a state to an event without abandoning the pending
+     *        transition, if any, _e.g._, that of another region of an orthogonal state
+     *        machine reacting to the same event. The target of the transition requested by
+     *        the state, if any, is not recorded.
+     * @param from       Identifier of the state that reacted.
+     * @param event      Identifier of the event.
+     * @param transition Whether the state requested a transition.
+     */
+    void record_concurrent_reaction(TypeId from, std::uint32_t event, bool transition) noexcept {
+        write(from, event, transition ? unrecorded : TypeId{});
+    }
+
+    /**
+     * @brief Records the entry of a state, as the target of the pending transition, if any,
+     *        or as an initial state.
+     * @param to Identifier of the entered state.
+     */
+    void record_entry(TypeId to) noexcept {
+        if (pending_ == none) {
+            write(TypeId{}, TraceRecord::no_event, to);
+            return;
+        }
+        records_[pending_ & (N - 1)].to = to;
+        pending_ = none;
+    }
+
+    /**
+     * @brief Visits the records still held by the ring, from the oldest to the newest.
+     *        Calls no allocating function, so that it can be used from a crash handler if
+     *        the visitor allows it, _e.g._, one calling `write`.
+     * @tparam F Type of the visitor, called with a `const TraceRecord&`.
+     * @param f  Visitor.
+     */
+    template <typename F>
+    void for_each(F&& f) const {
+        const std::uint64_t end = recorded_;
+        const std::uint64_t begin = end > N ? end - N : 0;
+        for (std::uint64_t i = begin; i < end; ++i) {
+            f(records_[i & (N - 1)]);
+        }
+    }
+
+    /**
+     * @brief Forgets all the records.
+     */
+    void clear() noexcept {
+        recorded_ = 0;
+        pending_ = none;
+    }
+
+private:
+    // Target of the records of the transitions whose target is not recorded (yet)
+    static constexpr TypeId unrecorded = type_id<TraceRecord>();
+
+    // Value of TraceRing::pending_ without pending transition
+    static constexpr std::uint64_t none = UINT64_MAX;
+
+    void write(TypeId from, std::uint32_t event, TypeId to) noexcept {
+        records_[recorded_++ & (N - 1)] = {Clock::now(), from, to, event};
+    }
+
+    std::uint64_t recorded_{};
+    // Index of the record of the transition yet to enter its target
+    std::uint64_t pending_{none};
+    TraceRecord records_[N]{};
+};
+
+/**
+ * @brief Observer that records the reactions of the states to a TraceRing, along with the
+ *        states they transition to, then notifies the application-defined observer.
+ *        States reacting to events raised or deferred by the state machine are recorded
+ *        as well, in the order they react. The regions of an orthogonal state machine
+ *        react to an event before any of them transitions: only the target of the first
+ *        region to transition is then recorded, and the others are entered as initial states.
+ * @tparam R Type of the trace ring.
+ * @tparam O Application-defined observer policy.
+ */
+template <typename R = TraceRing<>, typename O = NullObserver>
+class TracingObserver : public O {
+public:
+    /**
+     * @brief Constructs a new observer recording to the input ring.
+     * @param ring     Ring to record to, which shall outlive the state machine.
+     * @param observer Application-defined observer to notify.
+     */
+    explicit TracingObserver(R& ring, O observer = O{}) : O{std::move(observer)}, ring_{&ring} {}
+
+    void after_react(TypeId id, std::size_t event_id,
+                     bool transition) noexcept(noexcept(O::after_react(id, event_id, transition))) {
+        if (reacted_) {
+            ring_->record_concurrent_reaction(id, static_cast<std::uint32_t>(event_id),
+                                              transition);
+        } else {
+            ring_->record_reaction(id, static_cast<std::uint32_t>(event_id), transition);
+            reacted_ = transition;
+        }
+        O::after_react(id, event_id, transition);
+    }
+
+    void before_exit(TypeId id) noexcept(noexcept(O::before_exit(id))) {
+        reacted_ = false;
+        O::before_exit(id);
+    }
+
+    void before_entry(TypeId id) noexcept(noexcept(O::before_entry(id))) {
+        ring_->record_entry(id);
+        O::before_entry(id);
+    }
+
+private:
+    R* ring_;
+    // Whether a state transitioned and none exited since, i.e., the other regions are reacting
+    bool reacted_{};
+};
+
+} // namespace unstately
+
+#endif // UNSTATELY_TRACE_H_
@@ -25,8 +25,17 @@
 #ifndef UNSTATELY_UNSTATELY_H_
 #define UNSTATELY_UNSTATELY_H_
 
+#include <algorithm>
+#include <array>
+#include <cassert>
+#include <cstddef>
+#include <cstdint>
 #include <memory>
+#include <new>
+#include <tuple>
+#include <type_traits>
 #include <utility>
+#include <variant>
 
 //! Library major version.
 #define UNSTATELY_VERSION_MAJOR 0
@@ -35,6 +44,15 @@
 //! Library patch version.
 #define UNSTATELY_VERSION_PATCH 0
 
+// Keeps the rarely taken paths out of the dispatching loops
+#if defined(__GNUC__)
+#define UNSTATELY_NOINLINE __attribute__((noinline))
+#elif defined(_MSC_VER)
+#define UNSTATELY_NOINLINE __declspec(noinline)
+#else
+#define UNSTATELY_NOINLINE
+#endif
+
 /**
  * @brief Library root namespace.
  */
@@ -73,255 +91,2664 @@ public:
 };
 
 /**
- * @brief The base class for all the states.
- *        All application-defined states shall inherit from this class.
- * @tparam A Type of the allocator to be used to create new states.
- * @tparam C Type of the state machine context.
- * @tparam EE Type list of the events that the state will handle.
+ * @brief Handler layout policy of the states that implement one EventHandlerUnit per event
+ *        type, each of which adds a vtable pointer to the state objects.
+ */
+struct VirtualHandlers {};
+
+/**
+ * @brief Handler layout policy of the states that carry a single vtable pointer, whatever
+ *        the number of events. Their handlers are public, non-virtual member functions
+ *        `void handle(Context&, const E&)`, called through a table of the concrete state
+ *        type indexed by event identifier. Events that neither a state nor its parents
+ *        handle are ignored by a shared no-op handler.
+ */
+struct TableHandlers {};
+
+/**
+ * @brief Implementation details. The application shall not use this namespace directly.
+ */
+namespace detail {
+
+/**
+ * @brief Assumed size of a cache line, used to keep data touched by different threads apart.
+ */
+constexpr std::size_t cache_line_size = 64;
+
+/**
+ * @brief Tells whether the allocation policy A keeps its storage inside each state machine,
+ *        _i.e._, whether it defines a nested Storage type.
+ */
+template <typename A, typename = void>
+struct HasStorage : std::false_type {};
+
+template <typename A>
+struct HasStorage<A, std::void_t<typename A::Storage>> : std::true_type {};
+
+/**
+ * @brief Tells whether T is a std::variant, _i.e._, a type-safe union of events.
+ */
+template <typename T>
+struct IsVariant : std::false_type {};
+
+template <typename... TT>
+struct IsVariant<std::variant<TT...>> : std::true_type {};
+
+/**
+ * @brief Gives the index of type T in the type list TT.
+ */
+template <typename T, typename... TT>
+struct IndexOf;
+
+template <typename T, typename... TT>
+struct IndexOf<T, T, TT...> : std::integral_constant<std::size_t, 0> {};
+
+template <typename T, typename U, typename... TT>
+struct IndexOf<T, U, TT...> : std::integral_constant<std::size_t, 1 + IndexOf<T, TT...>::value> {};
+
+/**
+ * @brief Table of functions, one per event type held by the variant V, that dispatch a
+ *        type-erased event to a state machine of type M.
+ */
+template <typename M, typename V>
+struct DispatchTable;
+
+template <typename M, typename... EE>
+struct DispatchTable<M, std::variant<EE...>> {
+    using Thunk = void (*)(M&, const void*);
+
+    template <typename E>
+    static void thunk(M& machine, const void* e) {
+        machine.dispatch(*static_cast<const E*>(e));
+    }
+
+    static constexpr Thunk thunks[] = {&thunk<EE>...};
+
+    static bool dispatch(M& machine, std::size_t id, const void* e) {
+        if (id >= sizeof...(EE)) {
+            return false;
+        }
+        thunks[id](machine, e);
+        return true;
+    }
+};
+
+template <typename A, bool = HasStorage<A>::value>
+class StorageHolder;
+
+/**
+ * @brief Gives states access to the allocation policy.
+ *        Policies without per-machine storage are reached through their static interface.
+ */
+template <typename A, bool = HasStorage<A>::value>
+class StorageBinding {
+protected:
+    template <typename T, typename... Args>
+    static auto make_state_ptr(Args&&... args) {
+        return A::template make_state_ptr<T>(std::forward<Args>(args)...);
+    }
+};
+
+/**
+ * @brief Gives states access to the allocation policy.
+ *        Policies with per-machine storage are reached through a pointer to the storage
+ *        of the state machine, which every state hands down to the states it creates.
+ */
+template <typename A>
+class StorageBinding<A, true> {
+protected:
+    template <typename T, typename... Args>
+    auto make_state_ptr(Args&&... args) {
+        auto state = storage_->template make_state_ptr<T>(std::forward<Args>(args)...);
+        StorageBinding& binding = *state;
+        binding.storage_ = storage_;
+        return state;
+    }
+
+private:
+    friend class StorageHolder<A, true>;
+
+    typename A::Storage* storage_{};
+};
+
+/**
+ * @brief Holds the per-machine storage of the allocation policy, if any.
+ *        Policies without per-machine storage are reached through their static interface.
+ */
+template <typename A>
+class StorageHolder<A, false> {
+protected:
+    template <typename T, typename... Args>
+    static auto make_state_ptr(Args&&... args) {
+        return A::template make_state_ptr<T>(std::forward<Args>(args)...);
+    }
+};
+
+/**
+ * @brief Holds the per-machine storage of the allocation policy, if any.
+ *        Since states point to it, state machines holding such a storage are not movable.
+ */
+template <typename A>
+class StorageHolder<A, true> {
+protected:
+    template <typename T, typename... Args>
+    auto make_state_ptr(Args&&... args) {
+        auto state = storage_.template make_state_ptr<T>(std::forward<Args>(args)...);
+        StorageBinding<A, true>& binding = *state;
+        binding.storage_ = &storage_;
+        return state;
+    }
+
+    typename A::Storage& storage() {
+        return storage_;
+    }
+
+    const typename A::Storage& storage() const {
+        return storage_;
+    }
+
+private:
+    typename A::Storage storage_{};
+};
+
+/**
+ * @brief Holds the observer of a state machine, taking no room if it is empty.
+ */
+template <typename O, bool = std::is_empty_v<O> && !std::is_final_v<O>>
+class ObserverHolder : private O {
+protected:
+    explicit ObserverHolder(O observer) : O{std::move(observer)} {}
+
+    O& observer() {
+        return *this;
+    }
+};
+
+template <typename O>
+class ObserverHolder<O, false> {
+protected:
+    explicit ObserverHolder(O observer) : observer_{std::move(observer)} {}
+
+    O& observer() {
+        return observer_;
+    }
+
+private:
+    O observer_;
+};
+
+/**
+ * @brief Provides a unique address for each type T.
+ */
+template <typename T>
+struct TypeTag {
+    static constexpr char tag{};
+};
+
+} // namespace detail
+
+/**
+ * @brief Cheap identifier of a type, _e.g._, of a concrete state, that does not require RTTI.
+ */
+using TypeId = const void*;
+
+/**
+ * @brief Gives the identifier of type T.
+ * @tparam T Type to identify.
+ * @return TypeId Identifier of T.
+ */
+template <typename T>
+constexpr TypeId type_id() noexcept {
+    return &detail::TypeTag<T>::tag;
+}
+
+/**
+ * @brief A compile-time list of types, _e.g._, the events that a state defers.
+ * @tparam TT Listed types.
+ */
+template <typename... TT>
+struct TypeList {};
+
+/**
+ * @brief An observer policy that does nothing and compiles away.
+ *        Application-defined observers shall provide the same member functions, which the
+ *        state machines call around each reaction, exit action, and entry action.
+ *        States are identified by their TypeId and events by State::event_id.
+ *        An observer may take the context as second argument of after_entry, _e.g._, to
+ *        publish some of its fields whenever the state changes: see StateMonitor.
+ *        Observers whose member functions are all noexcept let VariantStateMachine tell
+ *        whether dispatching can throw.
+ */
+class NullObserver {
+public:
+    void before_react(TypeId, std::size_t) noexcept {}
+
+    void after_react(TypeId, std::size_t, bool) noexcept {}
+
+    void before_exit(TypeId) noexcept {}
+
+    void after_exit(TypeId) noexcept {}
+
+    void before_entry(TypeId) noexcept {}
+
+    void after_entry(TypeId) noexcept {}
+};
+
+/**
+ * @brief Tag type selecting the state machine constructors that resume from a state that
+ *        has been entered already, _e.g._, when restoring a snapshot.
+ */
+struct ResumeTag {
+    explicit ResumeTag() = default;
+};
+
+/**
+ * @brief Tag value selecting the state machine constructors that resume from a state that
+ *        has been entered already: its entry actions are not executed again.
+ */
+inline constexpr ResumeTag resume{};
+
+/**
+ * @brief Transition policy of the state machines that replace the current state once it has
+ *        been exited, then run the entry actions of the next state. It adds nothing to the
+ *        dispatching path, but nor does it give any guarantee if a handler or an action
+ *        throws: the state machine may then be left in a state that has not been fully
+ *        entered, or with a pending requested state.
+ */
+struct DirectTransitions {};
+
+/**
+ * @brief Transition policy of the state machines that commit to the next state only once
+ *        its entry actions have all been executed, and fall back to the current state if a
+ *        handler or an action throws, before rethrowing. The state requested by a throwing
+ *        handler is discarded. If an exit action throws, the next state is discarded and the
+ *        current state stays current, without executing its remaining exit actions. If an
+ *        entry action throws, the next state is discarded without executing its exit actions,
+ *        and the exited levels of the current state are entered again.
+ *        Nothing is caught around what the state machine knows not to throw, see
+ *        VariantStateMachine::nothrow_dispatch, nor in builds without exceptions.
+ */
+struct TransactionalTransitions {};
+
+/**
+ * @brief Context policy of the states whose state machines share the ownership of a context
+ *        of type C, through a std::shared_ptr. Handlers take a `C&` all the same.
+ *        States whose context type is a reference `C&` instead have state machines referring
+ *        to a context that is owned elsewhere and shall outlive them.
+ * @tparam C Type of the shared context.
+ */
+template <typename C>
+struct SharedContext {};
+
+template <typename S, typename O = NullObserver, std::size_t N = 0,
+          typename X = DirectTransitions>
+class StateMachine;
+
+template <typename S, typename O = NullObserver, typename X = DirectTransitions>
+class VariantStateMachine;
+
+template <typename S, typename A>
+class BulkStateMachine;
+
+template <typename L, typename O>
+class OrthogonalStateMachine;
+
+template <typename S, typename L, typename O, std::size_t N>
+class TimedStateMachine;
+
+namespace detail {
+
+/**
+ * @brief Gives the parent of a nested state T, _i.e._, the type declared as `T::Parent`,
+ *        or void if T is a top-level state.
+ */
+template <typename T, typename = void>
+struct ParentOf {
+    using type = void;
+};
+
+template <typename T>
+struct ParentOf<T, std::void_t<typename T::Parent>> {
+    using type = typename T::Parent;
+};
+
+/**
+ * @brief Tells how a state machine stores the context of its states, given their context
+ *        policy C: owned by value, unless C is a reference `C&` or a SharedContext.
+ *        The arguments of the piecewise constructors of the state machines construct the
+ *        owned or shared context, or give the referred one.
+ */
+template <typename C>
+struct ContextBinding {
+    using type = C;
+    using Storage = C;
+    using Argument = C&&;
+
+    template <typename... CArgs>
+    static Storage make(std::tuple<CArgs...>&& args) {
+        return std::make_from_tuple<C>(std::move(args));
+    }
+
+    static C& get(Storage& storage) noexcept {
+        return storage;
+    }
+
+    static const C& get(const Storage& storage) noexcept {
+        return storage;
+    }
+};
+
+template <typename C>
+struct ContextBinding<C&> {
+    using type = C;
+    using Storage = C*;
+    using Argument = C&;
+
+    static Storage make(std::tuple<C&>&& args) noexcept {
+        return &std::get<0>(args);
+    }
+
+    static C& get(Storage storage) noexcept {
+        return *storage;
+    }
+};
+
+template <typename C>
+struct ContextBinding<SharedContext<C>> {
+    using type = C;
+    using Storage = std::shared_ptr<C>;
+    using Argument = std::shared_ptr<C>;
+
+    static Storage make(std::tuple<std::shared_ptr<C>&&>&& args) noexcept {
+        return std::move(std::get<0>(args));
+    }
+
+    template <typename... CArgs>
+    static Storage make(std::tuple<CArgs...>&& args) {
+        return std::apply(
+            [](auto&&... args) {
+                return std::make_shared<C>(std::forward<decltype(args)>(args)...);
+            },
+            std::move(args));
+    }
+
+    static C& get(const Storage& storage) noexcept {
+        return *storage;
+    }
+};
+
+/**
+ * @brief Tells whether the observer O takes the context C as second argument of after_entry.
+ */
+template <typename O, typename C, typename = void>
+struct ObservesEntryContext : std::false_type {};
+
+template <typename O, typename C>
+struct ObservesEntryContext<O, C,
+                            std::void_t<decltype(std::declval<O&>().after_entry(
+                                std::declval<TypeId>(), std::declval<const C&>()))>>
+    : std::true_type {};
+
+/**
+ * @brief Tells whether notifying the observer O that a state has been entered cannot throw.
+ */
+template <typename O, typename C>
+constexpr bool nothrow_after_entry = [] {
+    if constexpr (ObservesEntryContext<O, C>::value) {
+        return noexcept(std::declval<O&>().after_entry(TypeId{}, std::declval<const C&>()));
+    } else {
+        return noexcept(std::declval<O&>().after_entry(TypeId{}));
+    }
+}();
+
+/**
+ * @brief Notifies the observer that a state has been entered, along with the context if
+ *        it takes it.
+ */
+template <typename O, typename C>
+void notify_after_entry(O& observer, TypeId id, const C& c) noexcept(nothrow_after_entry<O, C>) {
+    if constexpr (ObservesEntryContext<O, C>::value) {
+        observer.after_entry(id, c);
+    } else {
+        observer.after_entry(id);
+    }
+}
+
+/**
+ * @brief Tells whether none of the member functions of the observer O throws.
+ */
+template <typename O, typename C>
+constexpr bool nothrow_observer = [] {
+    bool nothrow = noexcept(std::declval<O&>().before_react(TypeId{}, std::size_t{})) &&
+                   noexcept(std::declval<O&>().after_react(TypeId{}, std::size_t{}, bool{})) &&
+                   noexcept(std::declval<O&>().before_exit(TypeId{})) &&
+                   noexcept(std::declval<O&>().after_exit(TypeId{})) &&
+                   noexcept(std::declval<O&>().before_entry(TypeId{}));
+    return nothrow && nothrow_after_entry<O, C>;
+}();
+
+/**
+ * @brief Calls f and, if it throws, calls undo before rethrowing. Without exceptions, only
+ *        calls f.
+ */
+template <typename F, typename U>
+void attempt(F&& f, [[maybe_unused]] U&& undo) {
+#if defined(__cpp_exceptions) || defined(__EXCEPTIONS) || defined(_CPPUNWIND)
+    try {
+        f();
+    } catch (...) {
+        undo();
+        throw;
+    }
+#else
+    f();
+#endif
+}
+
+/**
+ * @brief Gives the class that declares the member function pointed by M.
+ */
+template <typename M>
+struct MemberClass;
+
+template <typename R, typename M, typename... Args>
+struct MemberClass<R (M::*)(Args...)> {
+    using type = M;
+};
+
+template <typename R, typename M, typename... Args>
+struct MemberClass<R (M::*)(Args...) noexcept> {
+    using type = M;
+};
+
+/**
+ * @brief Tells whether the state T declares a handler for the event E, or brings one into
+ *        its scope.
+ */
+template <typename T, typename C, typename E, typename = void>
+struct DeclaresHandler : std::false_type {};
+
+template <typename T, typename C, typename E>
+struct DeclaresHandler<
+    T, C, E, std::void_t<decltype(std::declval<T&>().T::handle(std::declval<C&>(),
+                                                               std::declval<const E&>()))>>
+    : std::true_type {};
+
+/**
+ * @brief Tells whether the state T, or any of its ancestors, declares a handler for the
+ *        event E.
+ */
+template <typename T, typename C, typename E>
+constexpr bool handles = [] {
+    if constexpr (std::is_void_v<T>) {
+        return false;
+    } else {
+        return DeclaresHandler<T, C, E>::value || handles<typename ParentOf<T>::type, C, E>;
+    }
+}();
+
+/**
+ * @brief Lets a state of concrete type D handle an event without a virtual call, using the
+ *        handler declared by T or by its nearest ancestor that declares one. States with
+ *        TableHandlers ignore the events that none of them handles.
+ */
+template <typename T, typename D, typename C, typename E>
+void handle_event(D& state, C& c, const E& e) {
+    if constexpr (DeclaresHandler<T, C, E>::value) {
+        state.T::handle(c, e);
+    } else if constexpr (!std::is_void_v<typename ParentOf<T>::type>) {
+        handle_event<typename ParentOf<T>::type>(state, c, e);
+    } else if constexpr (std::is_base_of_v<EventHandlerUnit<C, E>, D>) {
+        static_cast<EventHandlerUnit<C, E>&>(state).handle(c, e);
+    }
+}
+
+/**
+ * @brief Tells whether the handler that handle_event calls for the event E, looking it up
+ *        from T for a state of concrete type D, does not throw.
+ */
+template <typename T, typename D, typename C, typename E>
+constexpr bool nothrow_handler = [] {
+    if constexpr (DeclaresHandler<T, C, E>::value) {
+        return noexcept(std::declval<D&>().T::handle(std::declval<C&>(), std::declval<const E&>()));
+    } else if constexpr (!std::is_void_v<typename ParentOf<T>::type>) {
+        return nothrow_handler<typename ParentOf<T>::type, D, C, E>;
+    } else {
+        // The virtual handler of EventHandlerUnit may throw
+        return !std::is_base_of_v<EventHandlerUnit<C, E>, D>;
+    }
+}();
+
+/**
+ * @brief Gives the base class holding the handlers of the states with the layout policy H.
+ */
+template <typename H, typename C, typename... EE>
+struct HandlerBase {
+    using type = EventHandler<C, EE...>;
+};
+
+template <typename C, typename... EE>
+struct HandlerBase<TableHandlers, C, EE...> {
+    struct type {};
+};
+
+/**
+ * @brief Compile-time description of the position of state T in the state hierarchy.
+ * @tparam S Base class of the states.
+ * @tparam T Concrete or intermediate state type.
+ */
+template <typename S, typename T>
+struct Hierarchy {
+    /**
+     * @brief Parent of T, or void if T is a top-level state.
+     */
+    using Parent = typename ParentOf<T>::type;
+
+    /**
+     * @brief Number of levels from T to its top-level ancestor, both included.
+     */
+    static constexpr std::size_t depth = [] {
+        if constexpr (std::is_void_v<Parent>) {
+            return std::size_t{1};
+        } else {
+            return 1 + Hierarchy<S, Parent>::depth;
+        }
+    }();
+
+    /**
+     * @brief Identifiers of T and of all its ancestors, from T upward.
+     */
+    static constexpr std::array<TypeId, depth> ancestry = [] {
+        std::array<TypeId, depth> ids{};
+        ids[0] = type_id<T>();
+        if constexpr (!std::is_void_v<Parent>) {
+            for (std::size_t i = 1; i < depth; ++i) {
+                ids[i] = Hierarchy<S, Parent>::ancestry[i - 1];
+            }
+        }
+        return ids;
+    }();
+
+    /**
+     * @brief Level of X in the ancestry of T, or the depth of T if X is not one of them.
+     */
+    template <typename X>
+    static constexpr std::size_t level_of = [] {
+        if constexpr (std::is_same_v<X, T>) {
+            return std::size_t{0};
+        } else if constexpr (std::is_void_v<Parent>) {
+            return std::size_t{1};
+        } else {
+            return 1 + Hierarchy<S, Parent>::template level_of<X>;
+        }
+    }();
+
+    // A level has its own action unless T inherits it from its parent, or from S itself
+    using Above = std::conditional_t<std::is_void_v<Parent>, S, Parent>;
+
+    template <typename M>
+    static constexpr bool owns = !std::is_base_of_v<typename MemberClass<M>::type, Above>;
+
+    /**
+     * @brief Tells whether none of the entry and exit actions of T and of its ancestors
+     *        throws.
+     */
+    static constexpr bool nothrow_actions = [] {
+        bool nothrow = true;
+        if constexpr (owns<decltype(&T::entry)>) {
+            nothrow = noexcept(std::declval<T&>().T::entry(std::declval<typename S::Context&>()));
+        }
+        if constexpr (owns<decltype(&T::exit)>) {
+            nothrow = nothrow &&
+                      noexcept(std::declval<T&>().T::exit(std::declval<typename S::Context&>()));
+        }
+        if constexpr (!std::is_void_v<Parent>) {
+            nothrow = nothrow && Hierarchy<S, Parent>::nothrow_actions;
+        }
+        return nothrow;
+    }();
+
+    /**
+     * @brief Executes the exit actions of the given number of levels, from T upward.
+     * @tparam D Concrete type of the state.
+     */
+    template <typename D>
+    static void exit(D& state, typename S::Context& c, std::size_t levels) {
+        if (levels == 0) {
+            return;
+        }
+        if constexpr (owns<decltype(&T::exit)>) {
+            state.T::exit(c);
+        }
+        if constexpr (!std::is_void_v<Parent>) {
+            Hierarchy<S, Parent>::exit(state, c, levels - 1);
+        }
+    }
+
+    /**
+     * @brief Executes the entry actions of the given number of levels, downward to T.
+     * @tparam D Concrete type of the state.
+     */
+    template <typename D>
+    static void entry(D& state, typename S::Context& c, std::size_t levels) {
+        if (levels == 0) {
+            return;
+        }
+        if constexpr (!std::is_void_v<Parent>) {
+            Hierarchy<S, Parent>::entry(state, c, levels - 1);
+        }
+        if constexpr (owns<decltype(&T::entry)>) {
+            state.T::entry(c);
+        }
+    }
+};
+
+/**
+ * @brief Number of levels to exit and to enter when changing state.
+ */
+struct TransitionLevels {
+    std::size_t exit;
+    std::size_t entry;
+};
+
+/**
+ * @brief Computes the levels to exit and to enter to go from the source state to the target
+ *        state. The transition domain is the deepest proper ancestor of the source state that
+ *        is a proper ancestor of the target state too: the levels below it are exited and
+ *        entered, so that an external transition to the same state or to an ancestor exits
+ *        and re-enters it.
+ */
+constexpr TransitionLevels transition_levels(const TypeId* source, std::size_t source_depth,
+                                             const TypeId* target, std::size_t target_depth) {
+    for (std::size_t i = 1; i < source_depth; ++i) {
+        for (std::size_t j = 1; j < target_depth; ++j) {
+            if (source[i] == target[j]) {
+                return {i, j};
+            }
+        }
+    }
+    return {source_depth, target_depth};
+}
+
+/**
+ * @brief Compile-time counterpart of transition_levels, for a source state whose ancestor at
+ *        the given level is X and a target state U.
+ */
+template <typename S, typename X, typename U>
+constexpr TransitionLevels transition_levels(std::size_t level) {
+    if constexpr (std::is_void_v<X>) {
+        return {level, Hierarchy<S, U>::depth};
+    } else {
+        constexpr std::size_t target_level = Hierarchy<S, U>::template level_of<X>;
+        if (target_level != 0 && target_level < Hierarchy<S, U>::depth) {
+            return {level, target_level};
+        }
+        return transition_levels<S, typename ParentOf<X>::type, U>(level + 1);
+    }
+}
+
+/**
+ * @brief Gives the list of events that the state T itself defers.
+ */
+template <typename T, typename = void>
+struct DeferredOf {
+    using type = TypeList<>;
+};
+
+template <typename T>
+struct DeferredOf<T, std::void_t<typename T::Deferred>> {
+    using type = typename T::Deferred;
+};
+
+template <typename E, typename L>
+struct Contains;
+
+template <typename E, typename... TT>
+struct Contains<E, TypeList<TT...>> : std::bool_constant<(std::is_same_v<E, TT> || ...)> {};
+
+/**
+ * @brief Tells whether the state T, or any of its ancestors, defers the event E.
+ */
+template <typename T, typename E>
+constexpr bool defers = [] {
+    if constexpr (std::is_void_v<T>) {
+        return false;
+    } else {
+        return Contains<E, typename DeferredOf<T>::type>::value ||
+               defers<typename ParentOf<T>::type, E>;
+    }
+}();
+
+/**
+ * @brief Gives the list of events that the state T itself ignores.
+ */
+template <typename T, typename = void>
+struct IgnoredOf {
+    using type = TypeList<>;
+};
+
+template <typename T>
+struct IgnoredOf<T, std::void_t<typename T::Ignored>> {
+    using type = typename T::Ignored;
+};
+
+/**
+ * @brief Tells whether the state T, or any of its ancestors, lists the event E as ignored.
+ *        A state that declares a handler for E handles it even if its ancestors ignore it.
+ */
+template <typename T, typename C, typename E>
+constexpr bool lists_ignored = [] {
+    if constexpr (std::is_void_v<T>) {
+        return false;
+    } else {
+        return Contains<E, typename IgnoredOf<T>::type>::value ||
+               (!DeclaresHandler<T, C, E>::value &&
+                lists_ignored<typename ParentOf<T>::type, C, E>);
+    }
+}();
+
+/**
+ * @brief Tells whether the state T ignores the event E, either listing it as ignored or,
+ *        with TableHandlers, handling it at none of its levels.
+ */
+template <typename T, typename C, typename E>
+constexpr bool ignores =
+    lists_ignored<T, C, E> ||
+    (std::is_same_v<typename T::Handlers, TableHandlers> && !handles<T, C, E>);
+
+/**
+ * @brief Tells whether the state T has a guard for the event E, _i.e._, a member function
+ *        `bool guard(const Context&, const E&) const`, possibly inherited.
+ */
+template <typename T, typename C, typename E, typename = void>
+struct HasGuard : std::false_type {};
+
+template <typename T, typename C, typename E>
+struct HasGuard<T, C, E,
+                std::void_t<decltype(std::declval<const T&>().guard(std::declval<const C&>(),
+                                                                    std::declval<const E&>()))>>
+    : std::true_type {};
+
+/**
+ * @brief Tells whether the state T of concrete type shall react to the event E, _i.e._,
+ *        whether it does not ignore it and its guard, if any, holds.
+ */
+template <typename T, typename C, typename E>
+bool admits(const T& state, const C& c, const E& e) {
+    if constexpr (ignores<T, C, E>) {
+        return false;
+    } else if constexpr (HasGuard<T, C, E>::value) {
+        return static_cast<bool>(state.guard(c, e));
+    } else {
+        return true;
+    }
+}
+
+/**
+ * @brief Tells whether the state T of concrete type filters and handles the event E without
+ *        throwing, as admits and handle_event do.
+ */
+template <typename T, typename C, typename E>
+constexpr bool nothrow_reaction = [] {
+    if constexpr (ignores<T, C, E>) {
+        return true;
+    } else if constexpr (HasGuard<T, C, E>::value) {
+        return noexcept(static_cast<bool>(
+                   std::declval<const T&>().guard(std::declval<const C&>(),
+                                                  std::declval<const E&>()))) &&
+               nothrow_handler<T, T, C, E>;
+    } else {
+        return nothrow_handler<T, T, C, E>;
+    }
+}();
+
+/**
+ * @brief What a state machine does with an event before letting the current state react.
+ */
+enum class Disposition : unsigned char { react, defer, ignore, guard };
+
+template <typename T, typename C, typename E>
+constexpr Disposition disposition_of =
+    defers<T, E>                 ? Disposition::defer
+    : ignores<T, C, E>           ? Disposition::ignore
+    : HasGuard<T, C, E>::value   ? Disposition::guard
+                                 : Disposition::react;
+
+/**
+ * @brief Gives the list of states that the state T itself declares as permitted targets.
+ */
+template <typename T, typename = void>
+struct TargetsOf {
+    using type = TypeList<>;
+    static constexpr bool declared = false;
+};
+
+template <typename T>
+struct TargetsOf<T, std::void_t<typename T::Targets>> {
+    using type = typename T::Targets;
+    static constexpr bool declared = true;
+};
+
+/**
+ * @brief Concatenates type lists.
+ */
+template <typename... LL>
+struct Concat {
+    using type = TypeList<>;
+};
+
+template <typename... TT>
+struct Concat<TypeList<TT...>> {
+    using type = TypeList<TT...>;
+};
+
+template <typename... TT, typename... UU, typename... LL>
+struct Concat<TypeList<TT...>, TypeList<UU...>, LL...> : Concat<TypeList<TT..., UU...>, LL...> {};
+
+/**
+ * @brief Gives the list of states that the state T, or any of its ancestors, declares as
+ *        permitted targets, and whether any of them declares targets at all.
+ */
+template <typename T, bool = std::is_void_v<typename ParentOf<T>::type>>
+struct PermittedTargets {
+    using type = typename TargetsOf<T>::type;
+    static constexpr bool declared = TargetsOf<T>::declared;
+};
+
+template <typename T>
+struct PermittedTargets<T, false> {
+    using Above = PermittedTargets<typename ParentOf<T>::type>;
+    using type = typename Concat<typename TargetsOf<T>::type, typename Above::type>::type;
+    static constexpr bool declared = TargetsOf<T>::declared || Above::declared;
+};
+
+template <typename L>
+struct Permits;
+
+template <typename... TT>
+struct Permits<TypeList<TT...>> {
+    static bool check(TypeId target) noexcept {
+        return ((target == type_id<TT>()) || ...);
+    }
+};
+
+/**
+ * @brief Gives the timeout that the state T declares, see TimedStateMachine, or zero.
+ */
+template <typename T, typename = void>
+struct TimeoutOf : std::integral_constant<std::uint64_t, 0> {};
+
+template <typename T>
+struct TimeoutOf<T, std::void_t<decltype(T::timeout)>>
+    : std::integral_constant<std::uint64_t, T::timeout> {};
+
+/**
+ * @brief Run-time description of a concrete state type, stored by each state.
+ * @tparam S Base class of the states.
+ */
+template <typename S>
+struct StateInfo {
+    using Handler = void (*)(S& state, typename S::Context& c, const void* e);
+
+    using Guard = bool (*)(const S& state, const typename S::Context& c, const void* e);
+
+    const TypeId* ancestry;
+    std::size_t depth;
+    void (*exit)(S& state, typename S::Context& c, std::size_t levels);
+    void (*entry)(S& state, typename S::Context& c, std::size_t levels);
+    // Indexed by event identifier, and only set for the events that are filtered
+    const Guard* guards;
+    bool (*permits)(TypeId target) noexcept;
+    // Stored here so that TimedStateMachine arms timeouts without looking them up
+    std::uint64_t timeout;
+    // Indexed by event identifier, only for the states with TableHandlers, and stored here so
+    // that dispatching loads the handler from the same place as a vtable lookup would
+    std::array<Handler, std::is_same_v<typename S::Handlers, TableHandlers> ? S::event_count : 0>
+        handlers;
+    // Indexed by event identifier, and stored here for the same reason
+    std::array<Disposition, S::event_count> dispositions;
+};
+
+template <typename S>
+void ignore_event(S&, typename S::Context&, const void*) {}
+
+template <typename S, typename T, typename E>
+void handle_erased_event(S& state, typename S::Context& c, const void* e) {
+    handle_event<T>(static_cast<T&>(state), c, *static_cast<const E*>(e));
+}
+
+template <typename S, typename T, typename E>
+bool admits_erased_event(const S& state, const typename S::Context& c, const void* e) {
+    return admits(static_cast<const T&>(state), c, *static_cast<const E*>(e));
+}
+
+/**
+ * @brief Tables of the dispositions and of the guards of the concrete state type T, indexed
+ *        by the identifiers of the event types held by the variant V.
+ */
+template <typename S, typename T, typename V>
+struct EventFilters;
+
+template <typename S, typename T, typename... EE>
+struct EventFilters<S, T, std::variant<EE...>> {
+    using C = typename S::Context;
+
+    static constexpr std::array<Disposition, sizeof...(EE)> dispositions{
+        disposition_of<T, C, EE>...};
+
+    // Set for deferred events too, which state machines without event queues filter
+    static constexpr typename StateInfo<S>::Guard guards[] = {
+        (ignores<T, C, EE> || HasGuard<T, C, EE>::value ? &admits_erased_event<S, T, EE>
+                                                         : nullptr)...};
+};
+
+/**
+ * @brief Table of the handlers of the concrete state type T, indexed by the identifiers of
+ *        the event types held by the variant V.
+ */
+template <typename S, typename T, typename V>
+struct EventHandlers;
+
+template <typename S, typename T, typename... EE>
+struct EventHandlers<S, T, std::variant<EE...>> {
+    static constexpr std::array<typename StateInfo<S>::Handler, sizeof...(EE)> table{
+        (handles<T, typename S::Context, EE> ? &handle_erased_event<S, T, EE>
+                                             : &ignore_event<S>)...};
+};
+
+/**
+ * @brief Provides the StateInfo of the concrete state type T.
+ */
+template <typename S, typename T>
+struct StateDescriptor {
+    using Levels = Hierarchy<S, T>;
+
+    static void exit(S& state, typename S::Context& c, std::size_t levels) {
+        Levels::exit(static_cast<T&>(state), c, levels);
+    }
+
+    static void entry(S& state, typename S::Context& c, std::size_t levels) {
+        Levels::entry(static_cast<T&>(state), c, levels);
+    }
+
+    // States that declare no targets may request any of them
+    static bool permits(TypeId target) noexcept {
+        if constexpr (PermittedTargets<T>::declared) {
+            return Permits<typename PermittedTargets<T>::type>::check(target);
+        } else {
+            return true;
+        }
+    }
+
+    static constexpr auto handlers() {
+        if constexpr (std::is_same_v<typename S::Handlers, TableHandlers>) {
+            return EventHandlers<S, T, typename S::Event>::table;
+        } else {
+            return std::array<typename StateInfo<S>::Handler, 0>{};
+        }
+    }
+
+    static constexpr StateInfo<S> info{Levels::ancestry.data(),
+                                       Levels::depth,
+                                       &exit,
+                                       &entry,
+                                       EventFilters<S, T, typename S::Event>::guards,
+                                       &permits,
+                                       TimeoutOf<T>::value,
+                                       handlers(),
+                                       EventFilters<S, T, typename S::Event>::dispositions};
+};
+
+/**
+ * @brief A fixed-capacity double-ended queue of events, whose cells belong to its owner.
+ * @tparam E Type of the queued events.
+ */
+template <typename E>
+class EventRing {
+public:
+    EventRing(std::byte* cells, std::size_t capacity) noexcept
+        : cells_{cells}, capacity_{capacity} {}
+
+    ~EventRing() {
+        while (pop_front([](E&&) {})) {
+        }
+    }
+
+    EventRing(const EventRing& rhs) = delete;
+
+    EventRing& operator=(const EventRing& rhs) = delete;
+
+    template <typename T>
+    bool push_back(T&& e) {
+        if (size_ == capacity_) {
+            return false;
+        }
+        ::new (cell(wrap(head_ + size_))) E(std::forward<T>(e));
+        ++size_;
+        return true;
+    }
+
+    template <typename T>
+    bool push_front(T&& e) {
+        if (size_ == capacity_) {
+            return false;
+        }
+        head_ = wrap(head_ + capacity_ - 1);
+        ::new (cell(head_)) E(std::forward<T>(e));
+        ++size_;
+        return true;
+    }
+
+    // The cell is given back before the function is called, which may thus push again
+    template <typename F>
+    bool pop_front(F&& f) {
+        if (size_ == 0) {
+            return false;
+        }
+        E value{take(head_)};
+        head_ = wrap(head_ + 1);
+        --size_;
+        std::forward<F>(f)(std::move(value));
+        return true;
+    }
+
+    template <typename F>
+    bool pop_back(F&& f) {
+        if (size_ == 0) {
+            return false;
+        }
+        E value{take(wrap(head_ + size_ - 1))};
+        --size_;
+        std::forward<F>(f)(std::move(value));
+        return true;
+    }
+
+private:
+    std::size_t wrap(std::size_t index) const noexcept {
+        return index >= capacity_ ? index - capacity_ : index;
+    }
+
+    void* cell(std::size_t index) noexcept {
+        return cells_ + index * sizeof(E);
+    }
+
+    E take(std::size_t index) {
+        E& stored = *std::launder(reinterpret_cast<E*>(cell(index)));
+        E value{std::move(stored)};
+        stored.~E();
+        return value;
+    }
+
+    std::byte* cells_;
+    std::size_t capacity_;
+    std::size_t head_{};
+    std::size_t size_{};
+};
+
+/**
+ * @brief The queues of a state machine that states can reach: the internal events raised
+ *        by handlers and the events deferred by the current state.
+ */
+template <typename E>
+struct EventQueues {
+    EventRing<E> internal;
+    EventRing<E> deferred;
+};
+
+/**
+ * @brief Holds the event queues of a state machine, if any.
+ *        Since states point to them, state machines holding queues are not movable.
+ */
+template <typename E, std::size_t N>
+class EventQueueHolder {
+protected:
+    EventQueueHolder() = default;
+
+    EventQueueHolder(const EventQueueHolder& rhs) = delete;
+
+    EventQueueHolder& operator=(const EventQueueHolder& rhs) = delete;
+
+    EventQueues<E>* queues() noexcept {
+        return &queues_;
+    }
+
+private:
+    alignas(E) std::byte cells_[2][N * sizeof(E)];
+    EventQueues<E> queues_{{cells_[0], N}, {cells_[1], N}};
+};
+
+template <typename E>
+class EventQueueHolder<E, 0> {
+protected:
+    static constexpr EventQueues<E>* queues() noexcept {
+        return nullptr;
+    }
+};
+
+} // namespace detail
+
+/**
+ * @brief The base class for all the states.
+ *        All application-defined states shall inherit from this class.
+ *        States can be nested: a substate shall publicly derive from its parent state and
+ *        declare it as `using Parent = ...;`. Events that the substate does not handle are
+ *        thus handled by its parent, and changing state runs the exit and entry actions of
+ *        the levels below the transition domain only, each level running its own actions.
+ *        Notice: data members of parent states are part of each substate object, hence they
+ *        are not kept when changing substate. Shared data shall be stored in the context.
+ *        A state can also defer events, declaring them as `using Deferred = TypeList<...>;`:
+ *        a StateMachine with event queues then keeps these events, and those deferred by
+ *        parent states, until it enters a state that does not defer them.
+ *        Finally, a state can declare the states it may request as `using Targets =
+ *        TypeList<...>;`, which debug builds enforce and TransitionGraph analyzes. Targets
+ *        declared by parent states are permitted too.
+ *        Events can be filtered before they reach the handlers: a state lists those it ignores
+ *        as `using Ignored = TypeList<...>;`, and may guard an event E with a member function
+ *        `bool guard(const Context&, const E&) const`. State machines skip the reaction,
+ *        observer notifications included, if the current state ignores the event or if its
+ *        guard does not hold. Substates ignore the events ignored by their parents, except
+ *        those they declare a handler for. Deferring an event takes precedence over filtering
+ *        it, in the state machines that have event queues.
+ *        Handlers are virtual overrides of EventHandlerUnit::handle, unless the handler layout
+ *        policy is TableHandlers: see State and CompactState.
+ * @tparam H Handler layout policy, either VirtualHandlers or TableHandlers.
+ * @tparam A Type of the allocator to be used to create new states.
+ * @tparam C Type of the state machine context, owned by each state machine, or a reference
+ *           `Context&` or a SharedContext to share it between state machines.
+ * @tparam EE Type list of the events that the state will handle.
+ */
+template <typename H, typename A, typename C, typename... EE>
+class BasicState
+    : public detail::HandlerBase<H, typename detail::ContextBinding<C>::type, EE...>::type,
+      public detail::StorageBinding<A> {
+public:
+    /**
+     * @brief Handler layout policy type.
+     */
+    using Handlers = H;
+
+    /**
+     * @brief Allocation policy type used to create new states.
+     */
+    using Allocator = A;
+
+    /**
+     * @brief Context policy type, telling how the state machines store the context.
+     */
+    using ContextPolicy = C;
+
+    /**
+     * @brief Type of the state machine context.
+     */
+    using Context = typename detail::ContextBinding<C>::type;
+
+    /**
+     * @brief Pointer type used to return the next requested state.
+     */
+    using Ptr = typename Allocator::Ptr<BasicState>;
+
+    /**
+     * @brief Type able to hold any of the events that the state handles.
+     */
+    using Event = std::variant<EE...>;
+
+    /**
+     * @brief Number of events that the state handles.
+     */
+    static constexpr std::size_t event_count = sizeof...(EE);
+
+    /**
+     * @brief Index of the event type E in the list of handled events. It can be used as a
+     *        compact event identifier, _e.g._, with StateMachine::dispatch_by_id.
+     * @tparam E Type of the event.
+     */
+    template <typename E>
+    static constexpr std::size_t event_id = detail::IndexOf<E, EE...>::value;
+
+    explicit BasicState() = default;
+
+    virtual ~BasicState() = default;
+
+    BasicState(const BasicState& rhs) = delete;
+
+    BasicState(BasicState&& rhs) noexcept = default;
+
+    BasicState& operator=(const BasicState& rhs) = delete;
+
+    // Bookkeeping data belongs to the assigned object: only derived members are transferred
+    BasicState& operator=(BasicState&&) noexcept {
+        return *this;
+    }
+
+    /**
+     * @brief Entry action to be implemented by application-defined states.
+     * @param c State machine context.
+     */
+    virtual void entry(Context& c) = 0;
+
+    /**
+     * @brief Exit action to be implemented by application-defined states.
+     * @param c State machine context.
+     */
+    virtual void exit(Context& c) = 0;
+
+    /**
+     * @brief Reacts to an incoming event.
+     *        This method shall usually not be called directly but through a StateMachine.
+     * @tparam E Type of the event to react to.
+     * @param c State machine context.
+     * @param e Event to react to.
+     * @return Ptr Pointer the next state. May be empty if no transition is required.
+     */
+    template <typename E>
+    Ptr react(Context& c, const E& e) {
+        if constexpr (std::is_same_v<H, TableHandlers>) {
+            info_->handlers[event_id<E>](*this, c, &e);
+        } else {
+            EventHandlerUnit<Context, E>& handler = *this;
+            handler.handle(c, e);
+        }
+        return take_next_state();
+    }
+
+    /**
+     * @brief Takes the next state requested by the last handled event, if any.
+     *        This method shall usually not be called directly but through a state machine.
+     * @return Ptr Pointer the next state. May be empty if no transition is required.
+     */
+    Ptr take_next_state() {
+        return std::exchange(next_state_, Ptr{});
+    }
+
+    /**
+     * @brief Gives the identifier of the concrete type of the state.
+     * @return TypeId Identifier of the concrete state type.
+     */
+    TypeId type_id() const noexcept {
+        return info_ ? info_->ancestry[0] : TypeId{};
+    }
+
+protected:
+    /**
+     * @brief Sets the next state to be returned by the State::react method.
+     *        Application-defined states shall call this method inside their
+     *        EventHandlerUnit::handle implementations to trigger a state change.
+     * @tparam T Concrete type of the next state.
+     * @param next_state Next requested state.
+     */
+    template <typename T>
+    void request_transition(T&& next_state) {
+        make_next_state<T>(std::move(next_state));
+    }
+
+    /**
+     * @brief Sets the next state to be returned by the State::react method.
+     *        Application-defined states shall call this method inside their
+     *        EventHandlerUnit::handle implementations to trigger a state change.
+     * @tparam T Concrete type of the next state.
+     * @tparam Args Type list of the arguments to forward to T constructor.
+     * @param args Arguments to forward to T constructor.
+     */
+    template <typename T, typename... Args>
+    void request_transition(Args&&... args) {
+        make_next_state<T>(std::forward<Args>(args)...);
+    }
+
+    /**
+     * @brief Re-initializes the current state in place, as an internal transition: unlike
+     *        request_transition<T>, which performs an external self-transition, neither the
+     *        exit nor the entry action is executed and no state is allocated.
+     *        Application-defined states may call this method inside their
+     *        EventHandlerUnit::handle implementations.
+     * @tparam T Concrete type of the current state.
+     * @tparam Args Type list of the arguments to forward to T constructor.
+     * @param args Arguments to forward to T constructor.
+     */
+    template <typename T, typename... Args>
+    void reset_state(Args&&... args) {
+        assert(type_id() == unstately::type_id<T>());
+        static_cast<T&>(*this) = T{std::forward<Args>(args)...};
+    }
+
+    /**
+     * @brief Raises an internal event, which the state machine dispatches after the current
+     *        event has been handled, before returning from StateMachine::dispatch.
+     *        Application-defined states may call this method inside their entry and exit
+     *        actions and EventHandlerUnit::handle implementations, instead of dispatching
+     *        events to the state machine, which is not re-entrant.
+     * @tparam E Type of the event to raise.
+     * @param e  Event to raise.
+     * @return true if the event has been queued, false if the state machine has no queues
+     *         or if they are full.
+     */
+    template <typename E>
+    bool raise(E&& e) {
+        return queues_ && queues_->internal.push_back(std::forward<E>(e));
+    }
+
+private:
+    template <typename, typename, std::size_t, typename>
+    friend class StateMachine;
+
+    template <typename, typename, typename>
+    friend class VariantStateMachine;
+
+    template <typename, typename>
+    friend class BulkStateMachine;
+
+    template <typename, typename>
+    friend class OrthogonalStateMachine;
+
+    template <typename, typename, typename, std::size_t>
+    friend class TimedStateMachine;
+
+    template <typename T, typename... Args>
+    void make_next_state(Args&&... args) {
+        assert(!info_ || info_->permits(unstately::type_id<T>()));
+        // Release any previously requested state first, so that its storage can be reused
+        next_state_.reset();
+        next_state_ = this->template make_state_ptr<T>(std::forward<Args>(args)...);
+        next_state_->info_ = &detail::StateDescriptor<BasicState, T>::info;
+        next_state_->queues_ = queues_;
+    }
+
+    // Evaluates the guard of the event, or the filter of a deferred event, through the
+    // erased table of the concrete state
+    template <typename E>
+    bool passes_filter(const Context& c, const E& e) const {
+        const auto guard = info_->guards[event_id<E>];
+        return !guard || guard(*this, c, &e);
+    }
+
+    Ptr next_state_{};
+    const detail::StateInfo<BasicState>* info_{};
+    detail::EventQueues<Event>* queues_{};
+};
+
+/**
+ * @brief The base class of the states whose handlers override EventHandlerUnit::handle.
+ * @tparam A Type of the allocator to be used to create new states.
+ * @tparam C Type of the state machine context.
+ * @tparam EE Type list of the events that the state will handle.
+ */
+template <typename A, typename C, typename... EE>
+using State = BasicState<VirtualHandlers, A, C, EE...>;
+
+/**
+ * @brief The base class of the states that carry a single vtable pointer, whose handlers are
+ *        plain member functions and may be omitted: see TableHandlers.
+ * @tparam A Type of the allocator to be used to create new states.
+ * @tparam C Type of the state machine context.
+ * @tparam EE Type list of the events that the state will handle.
+ */
+template <typename A, typename C, typename... EE>
+using CompactState = BasicState<TableHandlers, A, C, EE...>;
+
+/**
+ * @brief The class representing the state machine.
+ *        It holds the current state and delegates to it the event handling.
+ *        With a non-zero queue capacity, it also holds two inline event queues: one for the
+ *        internal events raised by states, which are dispatched in order before returning
+ *        from StateMachine::dispatch, and one for the events deferred by the current state,
+ *        which are dispatched again, ahead of the internal ones, after each transition.
+ *        Events exceeding the queue capacity are discarded.
+ *        Since the states are type-erased, it cannot tell whether dispatching throws: with
+ *        TransactionalTransitions, it guards each reaction and each transition.
+ * @tparam S Base class of the states that this state machine can handle.
+ * @tparam O Observer policy notified around reactions, exit actions, and entry actions.
+ * @tparam N Capacity of each event queue, or zero not to have any.
+ * @tparam X Transition policy, either DirectTransitions or TransactionalTransitions.
+ */
+template <typename S, typename O, std::size_t N, typename X>
+class StateMachine : private detail::StorageHolder<typename S::Allocator>,
+                     private detail::ObserverHolder<O>,
+                     private detail::EventQueueHolder<typename S::Event, N> {
+public:
+    /**
+     * @brief Base class of the states.
+     */
+    using State = S;
+
+    /**
+     * @brief Allocation policy type used to create new states.
+     */
+    using StateAllocator = typename State::Allocator;
+
+    /**
+     * @brief Type of the state machine context.
+     */
+    using Context = typename State::Context;
+
+    /**
+     * @brief Type of the context argument of the constructors: `Context&&` if the state
+     *        machine owns the context, `Context&` if it refers to it, or a std::shared_ptr
+     *        if it shares it. Piecewise constructors may create the shared context too.
+     */
+    using ContextArgument =
+        typename detail::ContextBinding<typename State::ContextPolicy>::Argument;
+
+    /**
+     * @brief Pointer type used to store the current state.
+     */
+    using StatePtr = typename State::Ptr;
+
+    /**
+     * @brief Observer policy type.
+     */
+    using Observer = O;
+
+    /**
+     * @brief Transition policy type.
+     */
+    using Transitions = X;
+
+    /**
+     * @brief Constructs a new state machine object initialized with the input initial state.
+     * @tparam T Concrete type of the initial state.
+     * @param context       State machine context.
+     * @param initial_state Initial state to start from.
+     * @param observer      Observer to notify.
+     */
+    template <typename T>
+    explicit StateMachine(ContextArgument context, T&& initial_state,
+                          Observer observer = Observer{})
+        : StateMachine{std::piecewise_construct,
+                       std::forward_as_tuple(std::forward<ContextArgument>(context)),
+                       std::in_place_type<T>, std::forward_as_tuple(std::move(initial_state)),
+                       std::move(observer)} {}
+
+    /**
+     * @brief Constructs a new state machine object whose context and initial state are built
+     *        in place, directly in their final storage, from the input arguments.
+     * @tparam CArgs Type list of the arguments to forward to the Context constructor.
+     * @tparam T     Concrete type of the initial state.
+     * @tparam Args  Type list of the arguments to forward to T constructor.
+     * @param context_args Arguments to forward to the Context constructor, _e.g._, as given by
+     *                     std::forward_as_tuple.
+     * @param state_args   Arguments to forward to T constructor.
+     * @param observer     Observer to notify.
+     */
+    template <typename... CArgs, typename T, typename... Args>
+    StateMachine(std::piecewise_construct_t, std::tuple<CArgs...> context_args,
+                 std::in_place_type_t<T>, std::tuple<Args...> state_args,
+                 Observer observer = Observer{})
+        : detail::ObserverHolder<O>{std::move(observer)},
+          context_{ContextBinding::make(std::move(context_args))},
+          state_{std::apply(
+              [this](auto&&... args) {
+                  return this->template make_state_ptr<T>(std::forward<decltype(args)>(args)...);
+              },
+              std::move(state_args))} {
+        state_->info_ = &detail::StateDescriptor<State, T>::info;
+        state_->queues_ = this->queues();
+        entry(*state_, state_->info_->depth);
+        drain();
+    }
+
+    /**
+     * @brief Constructs a new state machine object that resumes from the input state,
+     *        which is deemed to have been entered already: no entry action is executed.
+     * @tparam T Concrete type of the current state.
+     * @param context       State machine context.
+     * @param current_state State to resume from.
+     * @param observer      Observer to notify.
+     */
+    template <typename T>
+    StateMachine(ResumeTag, ContextArgument context, T&& current_state,
+                 Observer observer = Observer{})
+        : detail::ObserverHolder<O>{std::move(observer)},
+          context_{ContextBinding::make(
+              std::forward_as_tuple(std::forward<ContextArgument>(context)))},
+          state_{this->template make_state_ptr<T>(std::move(current_state))} {
+        state_->info_ = &detail::StateDescriptor<State, T>::info;
+        state_->queues_ = this->queues();
+    }
+
+    ~StateMachine() {
+        // Non-null check is needed because the object may have been moved
+        if (state_) {
+            exit(state_->info_->depth);
+        }
+    }
+
+    StateMachine(const StateMachine& rhs) = delete;
+
+    StateMachine(StateMachine&& rhs) noexcept = default;
+
+    StateMachine& operator=(const StateMachine& rhs) = delete;
+
+    StateMachine& operator=(StateMachine&& rhs) noexcept = default;
+
+    /**
+     * @brief Dispatches the incoming event, _i.e._, lets the current state
+     *        react to the event.
+     * @tparam E Type of the event to dispatch.
+     * @param e  Event to dispatch.
+     */
+    template <typename E>
+    void dispatch(const E& e) {
+        if (auto next_state = react(*state_, e)) {
+            enter(std::move(next_state));
+        }
+        drain();
+    }
+
+    /**
+     * @brief Dispatches an event held by a std::variant.
+     * @tparam EE Type list of the events that the variant can hold.
+     * @param e   Event to dispatch.
+     */
+    template <typename... EE>
+    void dispatch(const std::variant<EE...>& e) {
+        std::visit([this](const auto& event) { dispatch(event); }, e);
+    }
+
+    /**
+     * @brief Dispatches a type-erased event through a table indexed by the event identifier.
+     * @param id Identifier of the event type, as given by State::event_id.
+     * @param e  Pointer to the event to dispatch, which shall be of the identified type.
+     * @return true if the event has been dispatched, false if the identifier is unknown.
+     */
+    bool dispatch_by_id(std::size_t id, const void* e) {
+        return detail::DispatchTable<StateMachine, typename State::Event>::dispatch(*this, id, e);
+    }
+
+    /**
+     * @brief Dispatches a batch of events in order, as if StateMachine::dispatch was called
+     *        on each of them. Events may be either plain events or std::variant objects.
+     *        The current state is looked up once and reloaded only after a transition.
+     * @tparam It Type of the input iterators.
+     * @param first Iterator to the first event to dispatch.
+     * @param last  Iterator past the last event to dispatch.
+     */
+    template <typename It>
+    void dispatch_all(It first, It last) {
+        State* state = state_.get();
+        for (; first != last; ++first) {
+            if (auto next_state = react(*state, *first)) {
+                enter(std::move(next_state));
+                state = state_.get();
+            }
+            if constexpr (N > 0) {
+                drain();
+                state = state_.get();
+            }
+        }
+    }
+
+    /**
+     * @brief Gives access to the observer.
+     * @return Observer& The observer.
+     */
+    Observer& observer() {
+        return detail::ObserverHolder<O>::observer();
+    }
+
+    /**
+     * @brief Gives read-only access to the context.
+     * @return const Context& The state machine context.
+     */
+    const Context& context() const noexcept {
+        return ContextBinding::get(context_);
+    }
+
+    /**
+     * @brief Gives read-only access to the current state.
+     * @return const State& The current state.
+     */
+    const State& state() const noexcept {
+        return *state_;
+    }
+
+private:
+    template <typename, typename, std::size_t>
+    friend class AwaitingStateMachine;
+
+    template <typename E>
+    StatePtr react(State& state, const E& e) {
+        if constexpr (detail::IsVariant<E>::value) {
+            return std::visit([this, &state](const auto& event) { return react(state, event); },
+                              e);
+        } else {
+            constexpr std::size_t event_id = State::template event_id<E>;
+            const detail::Disposition disposition = state.info_->dispositions[event_id];
+            if (disposition != detail::Disposition::react &&
+                (disposition == detail::Disposition::ignore || !admits(state, disposition, e))) {
+                return StatePtr{};
+            }
+            observer().before_react(state.type_id(), event_id);
+            StatePtr next_state = handle(state, e);
+            observer().after_react(state.type_id(), event_id, static_cast<bool>(next_state));
+            return next_state;
+        }
+    }
+
+    // Lets the state react, discarding the state it requested if the handler throws and
+    // transitions are transactional
+    template <typename E>
+    StatePtr handle(State& state, const E& e) {
+        if constexpr (transactional) {
+            StatePtr next_state{};
+            detail::attempt([this, &state, &e, &next_state] {
+                next_state = state.react(context_ref(), e);
+            }, [&state] { state.take_next_state(); });
+            return next_state;
+        } else {
+            return state.react(context_ref(), e);
+        }
+    }
+
+    // Defers the event, if there are queues, or evaluates the guard of the current state
+    template <typename E>
+    UNSTATELY_NOINLINE bool admits(State& state, detail::Disposition disposition, const E& e) {
+        if constexpr (N > 0) {
+            if (disposition == detail::Disposition::defer) {
+                [[maybe_unused]] const bool queued = this->queues()->deferred.push_back(e);
+                assert(queued);
+                return false;
+            }
+        }
+        return state.passes_filter(context_ref(), e);
+    }
+
+    void entry(State& state, std::size_t levels) {
+        observer().before_entry(state.type_id());
+        state.info_->entry(state, context_ref(), levels);
+        detail::notify_after_entry(observer(), state.type_id(), context_ref());
+    }
+
+    void exit(std::size_t levels) {
+        observer().before_exit(state_->type_id());
+        state_->info_->exit(*state_, context_ref(), levels);
+        observer().after_exit(state_->type_id());
+    }
+
+    void enter(StatePtr next_state) {
+        const detail::StateInfo<State>& source = *state_->info_;
+        const detail::StateInfo<State>& target = *next_state->info_;
+        const detail::TransitionLevels levels = detail::transition_levels(
+            source.ancestry, source.depth, target.ancestry, target.depth);
+        exit(levels.exit);
+        if constexpr (transactional) {
+            // The current state is released only once the next one has been entered
+            detail::attempt([this, &next_state, levels] { entry(*next_state, levels.entry); },
+                            [this, levels] { entry(*state_, levels.exit); });
+            state_ = std::move(next_state);
+        } else {
+            state_ = std::move(next_state);
+            entry(*state_, levels.entry);
+        }
+        recall();
+    }
+
+    // Completes a reaction that went on after StateMachine::dispatch returned, e.g., in the
+    // coroutine of an AwaitingStateMachine
+    void settle(std::size_t event_id) {
+        StatePtr next_state = state_->take_next_state();
+        observer().after_react(state_->type_id(), event_id, static_cast<bool>(next_state));
+        if (next_state) {
+            enter(std::move(next_state));
+        }
+        drain();
+    }
+
+    // Puts the deferred events back ahead of the internal ones, in their original order
+    void recall() {
+        if constexpr (N > 0) {
+            detail::EventQueues<typename State::Event>& queues = *this->queues();
+            while (queues.deferred.pop_back([&queues](typename State::Event&& e) {
+                [[maybe_unused]] const bool queued = queues.internal.push_front(std::move(e));
+                assert(queued);
+            })) {
+            }
+        }
+    }
+
+    void drain() {
+        if constexpr (N > 0) {
+            while (this->queues()->internal.pop_front([this](typename State::Event&& e) {
+                if (auto next_state = react(*state_, e)) {
+                    enter(std::move(next_state));
+                }
+            })) {
+            }
+        }
+    }
+
+    using ContextBinding = detail::ContextBinding<typename State::ContextPolicy>;
+
+    static constexpr bool transactional = std::is_same_v<X, TransactionalTransitions>;
+
+    Context& context_ref() noexcept {
+        return ContextBinding::get(context_);
+    }
+
+    typename ContextBinding::Storage context_{};
+    StatePtr state_{};
+};
+
+template <typename... TT>
+class VariantStateAllocator;
+
+namespace detail {
+
+/**
+ * @brief Tells whether the states of the variant allocation policy A reacting to the events
+ *        EE, if any, then being exited and entered, and the observer O, do not throw.
+ */
+template <typename S, typename O, typename A, typename... EE>
+constexpr bool nothrow_dispatch = false;
+
+template <typename T, typename C, typename... EE>
+constexpr bool nothrow_reactions = (nothrow_reaction<T, C, EE> && ...);
+
+template <typename S, typename O, typename... TT, typename... EE>
+constexpr bool nothrow_dispatch<S, O, VariantStateAllocator<TT...>, EE...> =
+    nothrow_observer<O, typename S::Context> && (Hierarchy<S, TT>::nothrow_actions && ...) &&
+    (nothrow_reactions<TT, typename S::Context, EE...> && ...);
+
+} // namespace detail
+
+/**
+ * @brief A state machine that stores its states in a std::variant and dispatches events
+ *        with std::visit. Entry and exit actions, as well as event handlers, are called on
+ *        the concrete state type without going through the vtable and can thus be inlined.
+ *        It accepts the same states as StateMachine, provided that they use a
+ *        VariantStateAllocator.
+ *        Handlers that a state inherits from its parent states are called directly too,
+ *        while those inherited from other classes go through the vtable.
+ *        Since all the states are known, it tells at compile time whether dispatching an
+ *        event can throw: if all the handlers, guards, actions, and observer member functions
+ *        that it may call are noexcept, so is VariantStateMachine::dispatch, and
+ *        TransactionalTransitions add nothing to it.
+ * @tparam S Base class of the states that this state machine can handle.
+ * @tparam O Observer policy notified around reactions, exit actions, and entry actions.
+ * @tparam X Transition policy, either DirectTransitions or TransactionalTransitions.
+ */
+template <typename S, typename O, typename X>
+class VariantStateMachine : private detail::StorageHolder<typename S::Allocator>,
+                            private detail::ObserverHolder<O> {
+public:
+    /**
+     * @brief Base class of the states.
+     */
+    using State = S;
+
+    /**
+     * @brief Allocation policy type used to create new states.
+     */
+    using StateAllocator = typename State::Allocator;
+
+    /**
+     * @brief Type of the state machine context.
+     */
+    using Context = typename State::Context;
+
+    /**
+     * @brief Type of the context argument of the constructors, see
+     *        StateMachine::ContextArgument.
+     */
+    using ContextArgument =
+        typename detail::ContextBinding<typename State::ContextPolicy>::Argument;
+
+    /**
+     * @brief Observer policy type.
+     */
+    using Observer = O;
+
+    /**
+     * @brief Transition policy type.
+     */
+    using Transitions = X;
+
+    /**
+     * @brief Tells whether dispatching the event E cannot throw, being made of noexcept calls
+     *        only.
+     * @tparam E Type of the event.
+     */
+    template <typename E>
+    static constexpr bool nothrow_dispatch =
+        detail::nothrow_dispatch<State, Observer, StateAllocator, E>;
+
+    /**
+     * @brief Constructs a new state machine object initialized with the input initial state.
+     * @tparam T Concrete type of the initial state.
+     * @param context       State machine context.
+     * @param initial_state Initial state to start from.
+     * @param observer      Observer to notify.
+     */
+    template <typename T>
+    explicit VariantStateMachine(ContextArgument context, T&& initial_state,
+                                 Observer observer = Observer{})
+        : VariantStateMachine{std::piecewise_construct,
+                              std::forward_as_tuple(std::forward<ContextArgument>(context)),
+                              std::in_place_type<T>,
+                              std::forward_as_tuple(std::move(initial_state)),
+                              std::move(observer)} {}
+
+    /**
+     * @brief Constructs a new state machine object whose context and initial state are built
+     *        in place, directly in their final storage, from the input arguments.
+     * @tparam CArgs Type list of the arguments to forward to the Context constructor.
+     * @tparam T     Concrete type of the initial state.
+     * @tparam Args  Type list of the arguments to forward to T constructor.
+     * @param context_args Arguments to forward to the Context constructor, _e.g._, as given by
+     *                     std::forward_as_tuple.
+     * @param state_args   Arguments to forward to T constructor.
+     * @param observer     Observer to notify.
+     */
+    template <typename... CArgs, typename T, typename... Args>
+    VariantStateMachine(std::piecewise_construct_t, std::tuple<CArgs...> context_args,
+                        std::in_place_type_t<T>, std::tuple<Args...> state_args,
+                        Observer observer = Observer{})
+        : detail::ObserverHolder<O>{std::move(observer)},
+          context_{ContextBinding::make(std::move(context_args))} {
+        // The storage owns the states: the pointer only tells where the state has been built
+        std::apply(
+            [this](auto&&... args) {
+                this->template make_state_ptr<T>(std::forward<decltype(args)>(args)...)
+                    .release()
+                    ->info_ = &detail::StateDescriptor<State, T>::info;
+            },
+            std::move(state_args));
+        std::visit([this](auto& state) { entry(state, depth(state)); }, current());
+    }
+
+    /**
+     * @brief Constructs a new state machine object that resumes from the input state,
+     *        which is deemed to have been entered already: no entry action is executed.
+     * @tparam T Concrete type of the current state.
+     * @param context       State machine context.
+     * @param current_state State to resume from.
+     * @param observer      Observer to notify.
+     */
+    template <typename T>
+    VariantStateMachine(ResumeTag, ContextArgument context, T&& current_state,
+                        Observer observer = Observer{})
+        : detail::ObserverHolder<O>{std::move(observer)},
+          context_{ContextBinding::make(
+              std::forward_as_tuple(std::forward<ContextArgument>(context)))} {
+        this->template make_state_ptr<T>(std::move(current_state)).release()->info_ =
+            &detail::StateDescriptor<State, T>::info;
+    }
+
+    ~VariantStateMachine() {
+        std::visit([this](auto& state) { exit(state, depth(state)); }, current());
+    }
+
+    VariantStateMachine(const VariantStateMachine& rhs) = delete;
+
+    VariantStateMachine& operator=(const VariantStateMachine& rhs) = delete;
+
+    /**
+     * @brief Dispatches the incoming event, _i.e._, lets the current state
+     *        react to the event.
+     * @tparam E Type of the event to dispatch.
+     * @param e  Event to dispatch.
+     */
+    template <typename E>
+    void dispatch(const E& e) noexcept(nothrow_dispatch<E>) {
+        const bool transition = std::visit([this, &e](auto& state) { return react(state, e); },
+                                           current());
+        if (transition) {
+            change_state();
+        }
+    }
+
+    /**
+     * @brief Dispatches an event held by a std::variant.
+     * @tparam EE Type list of the events that the variant can hold.
+     * @param e   Event to dispatch.
+     */
+    template <typename... EE>
+    void dispatch(const std::variant<EE...>& e) noexcept(
+        detail::nothrow_dispatch<State, Observer, StateAllocator, EE...>) {
+        std::visit([this](const auto& event) { dispatch(event); }, e);
+    }
+
+    /**
+     * @brief Dispatches a type-erased event through a table indexed by the event identifier.
+     * @param id Identifier of the event type, as given by State::event_id.
+     * @param e  Pointer to the event to dispatch, which shall be of the identified type.
+     * @return true if the event has been dispatched, false if the identifier is unknown.
+     */
+    bool dispatch_by_id(std::size_t id, const void* e) {
+        return detail::DispatchTable<VariantStateMachine, typename State::Event>::dispatch(
+            *this, id, e);
+    }
+
+    /**
+     * @brief Dispatches a batch of events in order, as if VariantStateMachine::dispatch was
+     *        called on each of them. Events may be either plain events or std::variant objects.
+     * @tparam It Type of the input iterators.
+     * @param first Iterator to the first event to dispatch.
+     * @param last  Iterator past the last event to dispatch.
+     */
+    template <typename It>
+    void dispatch_all(It first, It last) {
+        for (; first != last; ++first) {
+            dispatch(*first);
+        }
+    }
+
+    /**
+     * @brief Gives access to the observer.
+     * @return Observer& The observer.
+     */
+    Observer& observer() {
+        return detail::ObserverHolder<O>::observer();
+    }
+
+    /**
+     * @brief Gives read-only access to the context.
+     * @return const Context& The state machine context.
+     */
+    const Context& context() const noexcept {
+        return ContextBinding::get(context_);
+    }
+
+    /**
+     * @brief Gives read-only access to the current state.
+     * @return const State& The current state.
+     */
+    const State& state() const noexcept {
+        return *std::visit(
+            [](const auto& state) -> const State* {
+                if constexpr (std::is_same_v<std::decay_t<decltype(state)>, std::monostate>) {
+                    return nullptr;
+                } else {
+                    return &state;
+                }
+            },
+            this->storage().slot(active_));
+    }
+
+private:
+    auto& current() {
+        return this->storage().slot(active_);
+    }
+
+    auto& next() {
+        return this->storage().slot(active_ ^ 1U);
+    }
+
+    template <typename T>
+    static constexpr std::size_t depth(const T&) {
+        if constexpr (std::is_same_v<T, std::monostate>) {
+            return 0;
+        } else {
+            return detail::Hierarchy<State, T>::depth;
+        }
+    }
+
+    template <typename T>
+    void entry(T& state, std::size_t levels) {
+        if constexpr (!std::is_same_v<T, std::monostate>) {
+            observer().before_entry(type_id<T>());
+            detail::Hierarchy<State, T>::entry(state, context_ref(), levels);
+            detail::notify_after_entry(observer(), type_id<T>(), context_ref());
+        }
+    }
+
+    template <typename T>
+    void exit(T& state, std::size_t levels) {
+        if constexpr (!std::is_same_v<T, std::monostate>) {
+            observer().before_exit(type_id<T>());
+            detail::Hierarchy<State, T>::exit(state, context_ref(), levels);
+            observer().after_exit(type_id<T>());
+        }
+    }
+
+    template <typename T, typename U>
+    static constexpr detail::TransitionLevels levels_towards() {
+        if constexpr (std::is_same_v<T, std::monostate> || std::is_same_v<U, std::monostate>) {
+            return {0, 0};
+        } else {
+            return detail::transition_levels<State, typename detail::ParentOf<T>::type, U>(1);
+        }
+    }
+
+    // Exits the source state towards the target one and returns the number of levels to enter
+    template <typename T, typename U>
+    std::size_t exit_towards(T& source, const U&) {
+        constexpr detail::TransitionLevels levels = levels_towards<T, U>();
+        exit(source, levels.exit);
+        return levels.entry;
+    }
+
+    void change_state() {
+        if constexpr (transactional && !detail::nothrow_dispatch<State, O, StateAllocator>) {
+            commit_state();
+        } else {
+            // Both state types are known here: the levels to exit and to enter are constants
+            const std::size_t levels = std::visit(
+                [this](auto& source, const auto& target) { return exit_towards(source, target); },
+                current(), next());
+            current().template emplace<std::monostate>();
+            active_ ^= 1U;
+            std::visit([this, levels](auto& state) { entry(state, levels); }, current());
+        }
+    }
+
+    // Enters the next state in its slot before releasing the current one, which is entered
+    // again if the entry actions throw
+    void commit_state() {
+        const detail::TransitionLevels levels = std::visit(
+            [](const auto& source, const auto& target) {
+                return levels_towards<std::decay_t<decltype(source)>,
+                                      std::decay_t<decltype(target)>>();
+            },
+            current(), next());
+        detail::attempt(
+            [this, levels] {
+                std::visit([this, levels](auto& state) { exit(state, levels.exit); }, current());
+            },
+            [this] { next().template emplace<std::monostate>(); });
+        detail::attempt(
+            [this, levels] {
+                std::visit([this, levels](auto& state) { entry(state, levels.entry); }, next());
+            },
+            [this, levels] {
+                next().template emplace<std::monostate>();
+                std::visit([this, levels](auto& state) { entry(state, levels.exit); }, current());
+            });
+        current().template emplace<std::monostate>();
+        active_ ^= 1U;
+    }
+
+    template <typename T, typename E>
+    bool react(T& state, const E& e) {
+        if constexpr (!std::is_same_v<T, std::monostate>) {
+            constexpr std::size_t event_id = State::template event_id<E>;
+            if (!detail::admits(state, context_ref(), e)) {
+                return false;
+            }
+            observer().before_react(type_id<T>(), event_id);
+            handle(state, e);
+            const bool transition = state.take_next_state().release() != nullptr;
+            observer().after_react(type_id<T>(), event_id, transition);
+            return transition;
+        }
+        return false;
+    }
+
+    // Lets the state handle the event, discarding the state it requested if the handler
+    // throws and transitions are transactional
+    template <typename T, typename E>
+    void handle(T& state, const E& e) {
+        if constexpr (transactional && !detail::nothrow_reaction<T, Context, E>) {
+            detail::attempt(
+                [this, &state, &e] { detail::handle_event<T>(state, context_ref(), e); },
+                [&state] { state.take_next_state(); });
+        } else {
+            detail::handle_event<T>(state, context_ref(), e);
+        }
+    }
+
+    using ContextBinding = detail::ContextBinding<typename State::ContextPolicy>;
+
+    static constexpr bool transactional = std::is_same_v<X, TransactionalTransitions>;
+
+    Context& context_ref() noexcept {
+        return ContextBinding::get(context_);
+    }
+
+    typename ContextBinding::Storage context_{};
+    unsigned active_{};
+};
+
+namespace detail {
+
+/**
+ * @brief The single instance of a state type that reusing allocation policies hand out.
+ *        The first state is built in place from the arguments; later ones are assigned to
+ *        it, moving a single temporary when they are not given as is.
+ */
+template <typename T>
+class ReusedInstance {
+public:
+    ReusedInstance() = default;
+
+    ~ReusedInstance() {
+        if (constructed_) {
+            get().~T();
+        }
+    }
+
+    ReusedInstance(const ReusedInstance& rhs) = delete;
+
+    ReusedInstance& operator=(const ReusedInstance& rhs) = delete;
+
+    template <typename... Args>
+    T& assign(Args&&... args) {
+        if (!constructed_) {
+            ::new (bytes_) T(std::forward<Args>(args)...);
+            constructed_ = true;
+        } else if constexpr ((sizeof...(Args) == 1) &&
+                             (std::is_same_v<std::decay_t<Args>, T> && ...)) {
+            get() = (std::forward<Args>(args), ...);
+        } else {
+            get() = T(std::forward<Args>(args)...);
+        }
+        return get();
+    }
+
+private:
+    T& get() noexcept {
+        return *std::launder(reinterpret_cast<T*>(bytes_));
+    }
+
+    alignas(T) std::byte bytes_[sizeof(T)]{};
+    bool constructed_{};
+};
+
+} // namespace detail
+
+/**
+ * @brief A state allocation policy that stores states as static variables.
+ *        The first state of each type is built in place from the arguments; later ones are
+ *        assigned to it, moving a single temporary when they are not given as is.
+ *        Notice: all the state machines share the same instance of each state type, thus
+ *        only one of them at a time shall be in each state. Concrete state classes shall
+ *        implement the move assignment operator.
+ */
+class StaticStateAllocator {
+public:
+    /**
+     * @brief Deleter class for Ptr.
+     * @tparam T Type of the pointee object, usually the abstract State class.
+     */
+    class Deleter {
+    public:
+        void operator()(void*) const {}
+    };
+
+    /**
+     * @brief Pointer able to store statically-allocated states.
+     * @tparam T Type of the pointee object, usually the abstract State class.
+     */
+    template <typename T>
+    using Ptr = std::unique_ptr<T, Deleter>;
+
+    /**
+     * @brief Helper function to create a new statically-allocated state.
+     * @tparam T Concrete type of the state to create.
+     * @tparam Args Type list of the arguments to forward to T constructor.
+     * @param args Arguments to forward to T constructor.
+     * @return Ptr<T> Pointer to the newly created state.
+     */
+    template <typename T, typename... Args>
+    static Ptr<T> make_state_ptr(Args&&... args) {
+        return Ptr<T>{&get_state_instance<T>().assign(std::forward<Args>(args)...)};
+    }
+
+private:
+    template <typename T>
+    static detail::ReusedInstance<T>& get_state_instance() {
+        static detail::ReusedInstance<T> instance{};
+        return instance;
+    }
+};
+
+/**
+ * @brief A state allocation policy that stores states as thread-local variables, like
+ *        StaticStateAllocator but with one instance of each state type per thread: state
+ *        machines running on different threads do not share their states.
+ *        Notice: only one state machine per thread at a time shall be in each state, and
+ *        state machines shall not be handed over to other threads. Concrete state classes
+ *        shall implement the move assignment operator.
  */
-template <typename A, typename C, typename... EE>
-class State : public EventHandler<C, EE...> {
+class ThreadLocalStateAllocator {
 public:
     /**
-     * @brief Allocation policy type used to create new states.
+     * @brief Deleter class for Ptr.
+     * @tparam T Type of the pointee object, usually the abstract State class.
      */
-    using Allocator = A;
+    class Deleter {
+    public:
+        void operator()(void*) const {}
+    };
 
     /**
-     * @brief Type of the state machine context.
+     * @brief Pointer able to store thread-local states.
+     * @tparam T Type of the pointee object, usually the abstract State class.
      */
-    using Context = C;
+    template <typename T>
+    using Ptr = std::unique_ptr<T, Deleter>;
 
     /**
-     * @brief Pointer type used to return the next requested state.
+     * @brief Helper function to create a new thread-local state.
+     * @tparam T Concrete type of the state to create.
+     * @tparam Args Type list of the arguments to forward to T constructor.
+     * @param args Arguments to forward to T constructor.
+     * @return Ptr<T> Pointer to the newly created state.
      */
-    using Ptr = typename Allocator::Ptr<State<A, C, EE...>>;
-
-    explicit State() = default;
-
-    virtual ~State() = default;
-
-    State(const State& rhs) = delete;
-
-    State(State&& rhs) noexcept = default;
-
-    State& operator=(const State& rhs) = delete;
+    template <typename T, typename... Args>
+    static Ptr<T> make_state_ptr(Args&&... args) {
+        return Ptr<T>{&get_state_instance<T>().assign(std::forward<Args>(args)...)};
+    }
 
-    State& operator=(State&& rhs) noexcept = default;
+private:
+    template <typename T>
+    static detail::ReusedInstance<T>& get_state_instance() {
+        thread_local detail::ReusedInstance<T> instance{};
+        return instance;
+    }
+};
 
+/**
+ * @brief A state allocation policy that stores states inside the state machine itself, like
+ *        StaticStateAllocator but with one instance of each state type per state machine:
+ *        state machines do not share their states, and each state is reused, rather than
+ *        built again, every time that it is entered.
+ *        Notice: state machines using this policy are not movable. Concrete state classes
+ *        shall implement the move assignment operator.
+ * @tparam TT Type list of all the concrete states that the state machine can enter.
+ */
+template <typename... TT>
+class ReusedStateAllocator {
+public:
     /**
-     * @brief Entry action to be implemented by application-defined states.
-     * @param c State machine context.
+     * @brief Deleter class for Ptr.
+     * @tparam T Type of the pointee object, usually the abstract State class.
      */
-    virtual void entry(C& c) = 0;
+    class Deleter {
+    public:
+        void operator()(void*) const {}
+    };
 
     /**
-     * @brief Exit action to be implemented by application-defined states.
-     * @param c State machine context.
+     * @brief Pointer able to store reused states.
+     * @tparam T Type of the pointee object, usually the abstract State class.
      */
-    virtual void exit(C& c) = 0;
+    template <typename T>
+    using Ptr = std::unique_ptr<T, Deleter>;
 
     /**
-     * @brief Reacts to an incoming event.
-     *        This method shall usually not be called directly but through a StateMachine.
-     * @tparam E Type of the event to react to.
-     * @param c State machine context.
-     * @param e Event to react to.
-     * @return Ptr Pointer the next state. May be empty if no transition is required.
+     * @brief One instance of each state type embedded in each state machine.
      */
-    template <typename E>
-    Ptr react(C& c, const E& e) {
-        EventHandlerUnit<C, E>& handler = *this;
-        handler.handle(c, e);
-        return std::exchange(next_state_, Ptr{});
-    }
+    class Storage {
+    public:
+        Storage() = default;
 
-protected:
+        Storage(const Storage& rhs) = delete;
+
+        Storage& operator=(const Storage& rhs) = delete;
+
+        /**
+         * @brief Creates a new state in the instance of its type.
+         * @tparam T Concrete type of the state to create.
+         * @tparam Args Type list of the arguments to forward to T constructor.
+         * @param args Arguments to forward to T constructor.
+         * @return Ptr<T> Pointer to the newly created state.
+         */
+        template <typename T, typename... Args>
+        Ptr<T> make_state_ptr(Args&&... args) {
+            static_assert((std::is_same_v<T, TT> || ...),
+                          "State type not listed in ReusedStateAllocator");
+            auto& instance = std::get<detail::ReusedInstance<T>>(instances_);
+            return Ptr<T>{&instance.assign(std::forward<Args>(args)...)};
+        }
+
+    private:
+        std::tuple<detail::ReusedInstance<TT>...> instances_{};
+    };
+};
+
+/**
+ * @brief A state allocation policy that stores states on the heap.
+ */
+class UniqueStateAllocator {
+public:
     /**
-     * @brief Sets the next state to be returned by the State::react method.
-     *        Application-defined states shall call this method inside their
-     *        EventHandlerUnit::handle implementations to trigger a state change.
-     * @tparam T Concrete type of the next state.
-     * @param next_state Next requested state.
+     * @brief Pointer able to store dynamically-allocated states.
+     * @tparam T Type of the pointee object, usually the abstract State class.
      */
     template <typename T>
-    void request_transition(T&& next_state) {
-        next_state_ = Allocator::template make_state_ptr<T>(std::move(next_state));
-    }
+    using Ptr = std::unique_ptr<T>;
 
     /**
-     * @brief Sets the next state to be returned by the State::react method.
-     *        Application-defined states shall call this method inside their
-     *        EventHandlerUnit::handle implementations to trigger a state change.
-     * @tparam T Concrete type of the next state.
+     * @brief Helper function to create a new dinamically-allocated state.
+     * @tparam T Concrete type of the state to create.
      * @tparam Args Type list of the arguments to forward to T constructor.
      * @param args Arguments to forward to T constructor.
+     * @return Ptr<T> Pointer to the newly created state.
      */
     template <typename T, typename... Args>
-    void request_transition(Args&&... args) {
-        next_state_ = Allocator::template make_state_ptr<T>(std::forward<Args>(args)...);
+    static Ptr<T> make_state_ptr(Args&&... args) {
+        return std::make_unique<T>(std::forward<Args>(args)...);
     }
-
-private:
-    Ptr next_state_{};
 };
 
 /**
- * @brief The class representing the state machine.
- *        It holds the current state and delegates to it the event handling.
- * @tparam S Base class of the states that this state machine can handle.
+ * @brief A state allocation policy that recycles the storage of destroyed states.
+ *        Each thread keeps, for each concrete state type, a free list of up to N blocks:
+ *        once warmed up, transitions do not touch the heap anymore. Since blocks are
+ *        allocated and first written to by the thread that dispatches, they are usually
+ *        placed on its NUMA node by the operating system, and stay there while recycled.
+ *        Blocks may be aligned and padded, _e.g._, to cache lines, so that the states of
+ *        machines dispatched on different threads never share one.
+ *        Notice: state machines using this policy shall not have static storage duration,
+ *        since the pools are destroyed together with the thread that owns them.
+ * @tparam N         Maximum number of free blocks retained per state type and per thread.
+ * @tparam Alignment Minimum alignment of the blocks, and multiple of their size, or zero to
+ *                   use those of the states.
  */
-template <typename S>
-class StateMachine {
+template <std::size_t N = 4, std::size_t Alignment = 0>
+class PoolStateAllocator {
 public:
     /**
-     * @brief Base class of the states.
+     * @brief Deleter class for Ptr. It destroys the state and gives its storage back to
+     *        the pool of the creating type.
      */
-    using State = S;
+    class Deleter {
+    public:
+        Deleter() = default;
 
-    /**
-     * @brief Allocation policy type used to create new states.
-     */
-    using StateAllocator = typename State::Allocator;
+        Deleter(void* block, void (*release)(void*)) noexcept : block_{block}, release_{release} {}
 
-    /**
-     * @brief Type of the state machine context.
-     */
-    using Context = typename State::Context;
+        template <typename T>
+        void operator()(T* p) const {
+            p->~T();
+            release_(block_);
+        }
+
+    private:
+        void* block_{};
+        void (*release_)(void*){};
+    };
 
     /**
-     * @brief Pointer type used to store the current state.
+     * @brief Pointer able to store pool-allocated states.
+     * @tparam T Type of the pointee object, usually the abstract State class.
      */
-    using StatePtr = typename State::Ptr;
+    template <typename T>
+    using Ptr = std::unique_ptr<T, Deleter>;
 
     /**
-     * @brief Constructs a new state machine object initialized with the input initial state.
-     * @tparam T Concrete type of the initial state.
-     * @param context       State machine context.
-     * @param initial_state Initial state to start from.
+     * @brief Helper function to create a new pool-allocated state.
+     * @tparam T Concrete type of the state to create.
+     * @tparam Args Type list of the arguments to forward to T constructor.
+     * @param args Arguments to forward to T constructor.
+     * @return Ptr<T> Pointer to the newly created state.
      */
-    template <typename T>
-    explicit StateMachine(Context&& context, T&& initial_state)
-        : context_{std::move(context)},
-          state_{StateAllocator::template make_state_ptr<T>(std::move(initial_state))} {
-        state_->entry(context_);
+    template <typename T, typename... Args>
+    static Ptr<T> make_state_ptr(Args&&... args) {
+        BlockGuard<T> guard{get_pool<T>().acquire()};
+        T* instance = ::new (guard.block) T(std::forward<Args>(args)...);
+        return Ptr<T>{instance, Deleter{std::exchange(guard.block, nullptr), &release<T>}};
     }
 
-    ~StateMachine() {
-        // Non-null check is needed because the object may have been moved
-        if (state_) {
-            state_->exit(context_);
+private:
+    template <typename T>
+    class Pool {
+    public:
+        Pool() = default;
+
+        ~Pool() {
+            while (head_) {
+                deallocate(std::exchange(head_, head_->next));
+            }
         }
-    }
 
-    StateMachine(const StateMachine& rhs) = delete;
+        Pool(const Pool& rhs) = delete;
 
-    StateMachine(StateMachine&& rhs) noexcept = default;
+        Pool& operator=(const Pool& rhs) = delete;
 
-    StateMachine& operator=(const StateMachine& rhs) = delete;
+        void* acquire() {
+            if (!head_) {
+                return allocate();
+            }
+            --size_;
+            return std::exchange(head_, head_->next);
+        }
 
-    StateMachine& operator=(StateMachine&& rhs) noexcept = default;
+        void release(void* block) noexcept {
+            if (size_ == N) {
+                deallocate(block);
+                return;
+            }
+            ++size_;
+            head_ = ::new (block) Node{head_};
+        }
 
-    /**
-     * @brief Dispatches the incoming event, _i.e._, lets the current state
-     *        react to the event.
-     * @tparam E Type of the event to dispatch.
-     * @param e  Event to dispatch.
-     */
-    template <typename E>
-    void dispatch(const E& e) {
-        if (auto next_state = state_->react(context_, e)) {
-            state_->exit(context_);
-            state_ = std::move(next_state);
-            state_->entry(context_);
+    private:
+        struct Node {
+            Node* next;
+        };
+
+        static_assert(sizeof(T) >= sizeof(Node) && alignof(T) >= alignof(Node));
+        static_assert((Alignment & (Alignment - 1)) == 0, "Alignment shall be a power of two");
+
+        static constexpr std::size_t alignment = std::max(alignof(T), Alignment);
+        static constexpr std::size_t size = (sizeof(T) + alignment - 1) / alignment * alignment;
+
+        static void* allocate() {
+            if constexpr (alignment > __STDCPP_DEFAULT_NEW_ALIGNMENT__) {
+                return ::operator new(size, std::align_val_t{alignment});
+            } else {
+                return ::operator new(size);
+            }
+        }
+
+        static void deallocate(void* block) noexcept {
+            if constexpr (alignment > __STDCPP_DEFAULT_NEW_ALIGNMENT__) {
+                ::operator delete(block, std::align_val_t{alignment});
+            } else {
+                ::operator delete(block);
+            }
+        }
+
+        Node* head_{};
+        std::size_t size_{};
+    };
+
+    // Gives the block back to the pool if the state constructor throws.
+    template <typename T>
+    struct BlockGuard {
+        ~BlockGuard() {
+            if (block) {
+                release<T>(block);
+            }
         }
+
+        void* block;
+    };
+
+    template <typename T>
+    static Pool<T>& get_pool() {
+        thread_local Pool<T> pool{};
+        return pool;
     }
 
-private:
-    Context context_{};
-    StatePtr state_{};
+    template <typename T>
+    static void release(void* block) {
+        get_pool<T>().release(block);
+    }
 };
 
 /**
- * @brief A state allocation policy that stores states as static variables.
- *        Notice: concrete state classes shall implement an empty constructor and the
- *        move assignment operator.
+ * @brief A state allocation policy that stores states inside the state machine itself.
+ *        The state machine holds two buffers, each large enough for any of the listed state
+ *        types: the next state is built in the buffer that the current state does not use.
+ *        Notice: state machines using this policy are not movable.
+ * @tparam TT Type list of all the concrete states that the state machine can enter.
  */
-class StaticStateAllocator {
+template <typename... TT>
+class InlineStateAllocator {
 public:
     /**
-     * @brief Deleter class for Ptr.
-     * @tparam T Type of the pointee object, usually the abstract State class.
+     * @brief Deleter class for Ptr. It destroys the state and marks its buffer as free.
      */
     class Deleter {
     public:
-        void operator()(void*) const {}
+        Deleter() = default;
+
+        explicit Deleter(bool* in_use) noexcept : in_use_{in_use} {}
+
+        template <typename T>
+        void operator()(T* p) const {
+            p->~T();
+            *in_use_ = false;
+        }
+
+    private:
+        bool* in_use_{};
     };
 
     /**
-     * @brief Pointer able to store statically-allocated states.
+     * @brief Pointer able to store inline-allocated states.
      * @tparam T Type of the pointee object, usually the abstract State class.
      */
     template <typename T>
     using Ptr = std::unique_ptr<T, Deleter>;
 
     /**
-     * @brief Helper function to create a new statically-allocated state.
-     * @tparam T Concrete type of the state to create.
-     * @tparam Args Type list of the arguments to forward to T constructor.
-     * @param args Arguments to forward to T constructor.
-     * @return Ptr<T> Pointer to the newly created state.
+     * @brief Double buffer embedded in each state machine.
      */
-    template <typename T, typename... Args>
-    static Ptr<T> make_state_ptr(Args&&... args) {
-        T& instance = get_state_instance<T>();
-        instance = T{std::forward<Args>(args)...};
-        return Ptr<T>{&instance};
-    }
+    class Storage {
+    public:
+        Storage() = default;
 
-private:
-    template <typename T>
-    static T& get_state_instance() {
-        static T instance{};
-        return instance;
-    }
+        Storage(const Storage& rhs) = delete;
+
+        Storage& operator=(const Storage& rhs) = delete;
+
+        /**
+         * @brief Creates a new state in the free buffer.
+         * @tparam T Concrete type of the state to create.
+         * @tparam Args Type list of the arguments to forward to T constructor.
+         * @param args Arguments to forward to T constructor.
+         * @return Ptr<T> Pointer to the newly created state.
+         */
+        template <typename T, typename... Args>
+        Ptr<T> make_state_ptr(Args&&... args) {
+            static_assert((std::is_same_v<T, TT> || ...),
+                          "State type not listed in InlineStateAllocator");
+            Buffer& buffer = buffers_[buffers_[0].in_use ? 1 : 0];
+            T* instance = ::new (buffer.bytes) T(std::forward<Args>(args)...);
+            buffer.in_use = true;
+            return Ptr<T>{instance, Deleter{&buffer.in_use}};
+        }
+
+    private:
+        struct Buffer {
+            alignas(TT...) std::byte bytes[std::max({sizeof(TT)...})];
+            bool in_use{};
+        };
+
+        Buffer buffers_[2]{};
+    };
 };
 
 /**
- * @brief A state allocation policy that stores states on the heap.
+ * @brief A state allocation policy that stores states inside the state machine itself, as
+ *        alternatives of two std::variant objects: the next state is built in the variant
+ *        that the current state does not use.
+ *        It is required by VariantStateMachine but can be used with StateMachine as well.
+ *        Notice: state machines using this policy are not movable.
+ * @tparam TT Type list of all the concrete states that the state machine can enter.
  */
-class UniqueStateAllocator {
+template <typename... TT>
+class VariantStateAllocator {
 public:
     /**
-     * @brief Pointer able to store dynamically-allocated states.
+     * @brief Type of the variant able to hold any of the states.
+     */
+    using Variant = std::variant<std::monostate, TT...>;
+
+    /**
+     * @brief Deleter class for Ptr. It destroys the state by emptying its variant.
+     */
+    class Deleter {
+    public:
+        Deleter() = default;
+
+        explicit Deleter(Variant* slot) noexcept : slot_{slot} {}
+
+        void operator()(void*) const {
+            slot_->template emplace<std::monostate>();
+        }
+
+    private:
+        Variant* slot_{};
+    };
+
+    /**
+     * @brief Pointer able to store variant-allocated states.
      * @tparam T Type of the pointee object, usually the abstract State class.
      */
     template <typename T>
-    using Ptr = std::unique_ptr<T>;
+    using Ptr = std::unique_ptr<T, Deleter>;
 
     /**
-     * @brief Helper function to create a new dinamically-allocated state.
-     * @tparam T Concrete type of the state to create.
-     * @tparam Args Type list of the arguments to forward to T constructor.
-     * @param args Arguments to forward to T constructor.
-     * @return Ptr<T> Pointer to the newly created state.
+     * @brief Pair of variants embedded in each state machine.
      */
-    template <typename T, typename... Args>
-    static Ptr<T> make_state_ptr(Args&&... args) {
-        return std::make_unique<T>(std::forward<Args>(args)...);
-    }
+    class Storage {
+    public:
+        Storage() = default;
+
+        Storage(const Storage& rhs) = delete;
+
+        Storage& operator=(const Storage& rhs) = delete;
+
+        /**
+         * @brief Creates a new state in the empty variant.
+         * @tparam T Concrete type of the state to create.
+         * @tparam Args Type list of the arguments to forward to T constructor.
+         * @param args Arguments to forward to T constructor.
+         * @return Ptr<T> Pointer to the newly created state.
+         */
+        template <typename T, typename... Args>
+        Ptr<T> make_state_ptr(Args&&... args) {
+            static_assert((std::is_same_v<T, TT> || ...),
+                          "State type not listed in VariantStateAllocator");
+            Variant& slot = slots_[std::holds_alternative<std::monostate>(slots_[0]) ? 0 : 1];
+            T& instance = slot.template emplace<T>(std::forward<Args>(args)...);
+            return Ptr<T>{&instance, Deleter{&slot}};
+        }
+
+        /**
+         * @brief Gives access to one of the two variants.
+         * @param index Index of the variant, either 0 or 1.
+         * @return Variant& The requested variant.
+         */
+        Variant& slot(unsigned index) {
+            return slots_[index];
+        }
+
+        /**
+         * @brief Gives read-only access to one of the two variants.
+         * @param index Index of the variant, either 0 or 1.
+         * @return const Variant& The requested variant.
+         */
+        const Variant& slot(unsigned index) const {
+            return slots_[index];
+        }
+
+    private:
+        Variant slots_[2]{};
+    };
 };
 
 /**
  * @brief Shortcut for a State type using static allocation policy.
- *        Notice: concrete state classes shall implement an empty constructor and the
- *        move assignment operator.
+ *        Notice: concrete state classes shall implement the move assignment operator.
  * @tparam C Type of the state machine context.
  * @tparam EE Type list of the events that the state will handle.
  */
 template <typename C, typename... EE>
 using StaticState = State<StaticStateAllocator, C, EE...>;
 
+/**
+ * @brief Shortcut for a State type using thread-local allocation policy.
+ *        Notice: concrete state classes shall implement the move assignment operator.
+ * @tparam C Type of the state machine context.
+ * @tparam EE Type list of the events that the state will handle.
+ */
+template <typename C, typename... EE>
+using ThreadLocalState = State<ThreadLocalStateAllocator, C, EE...>;
+
 /**
  * @brief Shortcut for a State type using dynamic allocation policy.
  * @tparam C Type of the state machine context.
@@ -330,6 +2757,14 @@ using StaticState = State<StaticStateAllocator, C, EE...>;
 template <typename C, typename... EE>
 using UniqueState = State<UniqueStateAllocator, C, EE...>;
 
+/**
+ * @brief Shortcut for a State type using pooled allocation policy.
+ * @tparam C Type of the state machine context.
+ * @tparam EE Type list of the events that the state will handle.
+ */
+template <typename C, typename... EE>
+using PooledState = State<PoolStateAllocator<>, C, EE...>;
+
 } // namespace unstately
 
 #endif // UNSTATELY_UNSTATELY_H_
@@ -0,0 +1,518 @@
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <iomanip>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <unstately/async.h>
+#include <unstately/bulk.h>
+#include <unstately/executor.h>
+#include <unstately/replay.h>
+#include <unstately/unstately.h>
+
+// Load generator for the concurrent and multi-machine parts of the library, driving fleets of
+// turnstiles, see `examples/turnstile`, with a configurable mix of coins and pushes.
+// Each scenario reports its throughput and the percentiles of its latencies, and checks that
+// every event has been dispatched once: the exit status is non-zero otherwise.
+
+namespace {
+
+std::uint64_t now_ns() {
+    return static_cast<std::uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(
+                                          std::chrono::steady_clock::now().time_since_epoch())
+                                          .count());
+}
+
+// The `Context` class here counts the events dispatched to a turnstile and, if given a vector,
+// samples the time elapsed since each event was posted.
+struct Context {
+    std::vector<std::uint64_t>* latencies{};
+    std::uint64_t dispatched{};
+    std::uint64_t passages{};
+};
+
+// Define the events, which carry the time they were posted at, or zero.
+struct CoinInserted {
+    std::uint64_t posted;
+};
+
+struct ArmPushed {
+    std::uint64_t posted;
+};
+
+void record(Context& context, std::uint64_t posted) {
+    ++context.dispatched;
+    if (context.latencies && posted != 0) {
+        context.latencies->push_back(now_ns() - posted);
+    }
+}
+
+// The turnstile model, with the allocation policy as a parameter since the bulk engine needs
+// its states listed as columns.
+template <template <typename...> class A>
+struct Turnstile {
+    class Locked;
+    class Unlocked;
+
+    using State = unstately::State<A<Locked, Unlocked>, Context, CoinInserted, ArmPushed>;
+
+    class Locked : public State {
+    public:
+        void entry(Context&) override {}
+
+        void exit(Context&) override {}
+
+        void handle(Context& context, const CoinInserted& e) override {
+            record(context, e.posted);
+            this->template request_transition<Unlocked>();
+        }
+
+        void handle(Context& context, const ArmPushed& e) override {
+            record(context, e.posted);
+        }
+    };
+
+    class Unlocked : public State {
+    public:
+        void entry(Context&) override {}
+
+        void exit(Context& context) override {
+            ++context.passages;
+        }
+
+        void handle(Context& context, const CoinInserted& e) override {
+            record(context, e.posted);
+        }
+
+        void handle(Context& context, const ArmPushed& e) override {
+            record(context, e.posted);
+            this->template request_transition<Locked>();
+        }
+    };
+};
+
+template <typename... TT>
+using Pooled = unstately::PoolStateAllocator<>;
+
+template <typename... TT>
+using Columns = unstately::VariantStateAllocator<TT...>;
+
+using Model = Turnstile<Pooled>;
+using BulkModel = Turnstile<Columns>;
+
+// Command-line options, given as `--name=value`.
+struct Options {
+    std::string scenario{"all"};
+    std::size_t machines{1000};
+    std::size_t threads{std::max(2U, std::thread::hardware_concurrency()) / 2};
+    std::size_t producers{2};
+    std::uint64_t events{1000000};
+    unsigned coins{50};
+    std::uint64_t seed{1};
+    std::string format{"text"};
+};
+
+// Deterministic generator of the event mix, one per producer.
+class Mix {
+public:
+    Mix(std::uint64_t seed, unsigned coins) noexcept
+        : state_{seed * 0x9e3779b97f4a7c15U + 1}, coins_{coins} {}
+
+    bool coin() noexcept {
+        state_ ^= state_ << 13;
+        state_ ^= state_ >> 7;
+        state_ ^= state_ << 17;
+        return state_ % 100 < coins_;
+    }
+
+private:
+    std::uint64_t state_;
+    unsigned coins_;
+};
+
+struct Result {
+    std::string scenario;
+    // What a latency sample measures
+    std::string latency;
+    std::uint64_t events{};
+    std::uint64_t dispatched{};
+    double seconds{};
+    std::vector<std::uint64_t> samples{};
+};
+
+std::uint64_t percentile(std::vector<std::uint64_t>& samples, double q) {
+    if (samples.empty()) {
+        return 0;
+    }
+    const auto rank = static_cast<std::size_t>(q * static_cast<double>(samples.size() - 1));
+    std::nth_element(samples.begin(), samples.begin() + static_cast<std::ptrdiff_t>(rank),
+                     samples.end());
+    return samples[rank];
+}
+
+template <typename F>
+void run_threads(std::size_t count, F&& f) {
+    std::vector<std::thread> threads;
+    threads.reserve(count);
+    for (std::size_t i = 0; i < count; ++i) {
+        threads.emplace_back(f, i);
+    }
+    for (auto& thread : threads) {
+        thread.join();
+    }
+}
+
+// Producers post to asynchronous turnstiles, each one polled by one of the consumer threads.
+// Latency: from posting to dispatching.
+Result run_async(const Options& options) {
+    using Machine = unstately::AsyncStateMachine<unstately::StateMachine<Model::State>>;
+    const std::size_t machines = std::max<std::size_t>(1, options.machines);
+    const std::size_t consumers = std::clamp<std::size_t>(options.threads, 1, machines);
+    const std::size_t producers = std::max<std::size_t>(1, options.producers);
+    std::vector<std::vector<std::uint64_t>> latencies(machines);
+    std::vector<std::unique_ptr<Machine>> fleet;
+    for (std::size_t i = 0; i < machines; ++i) {
+        latencies[i].reserve(options.events / machines + 1);
+        fleet.push_back(std::make_unique<Machine>(Context{&latencies[i]}, Model::Locked{}));
+    }
+    std::atomic<std::uint64_t> consumed{};
+    const std::uint64_t start = now_ns();
+    std::thread producing{[&] {
+        run_threads(producers, [&](std::size_t producer) {
+            Mix mix{options.seed + producer, options.coins};
+            for (std::uint64_t i = producer; i < options.events; i += producers) {
+                Machine& machine = *fleet[i % machines];
+                if (mix.coin()) {
+                    machine.post(CoinInserted{now_ns()});
+                } else {
+                    machine.post(ArmPushed{now_ns()});
+                }
+            }
+        });
+    }};
+    run_threads(consumers, [&](std::size_t consumer) {
+        while (consumed.load(std::memory_order_relaxed) < options.events) {
+            std::size_t polled = 0;
+            for (std::size_t i = consumer; i < machines; i += consumers) {
+                polled += fleet[i]->poll();
+            }
+            if (polled == 0) {
+                std::this_thread::yield();
+            } else {
+                consumed.fetch_add(polled, std::memory_order_relaxed);
+            }
+        }
+    });
+    producing.join();
+    Result result{"async", "post_to_dispatch", options.events};
+    result.seconds = static_cast<double>(now_ns() - start) * 1e-9;
+    for (std::size_t i = 0; i < machines; ++i) {
+        result.dispatched += fleet[i]->machine().context().dispatched;
+        result.samples.insert(result.samples.end(), latencies[i].begin(), latencies[i].end());
+    }
+    return result;
+}
+
+// Producers post to turnstiles owned by an executor, whose workers dispatch them.
+// Latency: from posting to dispatching.
+Result run_executor(const Options& options) {
+    using Executor = unstately::Executor<unstately::StateMachine<Model::State>>;
+    const std::size_t machines = std::max<std::size_t>(1, options.machines);
+    const std::size_t producers = std::max<std::size_t>(1, options.producers);
+    std::vector<std::vector<std::uint64_t>> latencies(machines);
+    std::vector<Context> totals(machines);
+    std::uint64_t start = 0;
+    {
+        Executor executor{std::max<std::size_t>(1, options.threads)};
+        std::vector<Executor::Handle> handles;
+        for (std::size_t i = 0; i < machines; ++i) {
+            latencies[i].reserve(options.events / machines + 1);
+            handles.push_back(executor.spawn(Context{&latencies[i]}, Model::Locked{}));
+        }
+        start = now_ns();
+        run_threads(producers, [&](std::size_t producer) {
+            Mix mix{options.seed + producer, options.coins};
+            for (std::uint64_t i = producer; i < options.events; i += producers) {
+                const Executor::Handle machine = handles[i % machines];
+                if (mix.coin()) {
+                    executor.post(machine, CoinInserted{now_ns()});
+                } else {
+                    executor.post(machine, ArmPushed{now_ns()});
+                }
+            }
+        });
+        executor.wait_idle();
+    }
+    Result result{"executor", "post_to_dispatch", options.events};
+    result.seconds = static_cast<double>(now_ns() - start) * 1e-9;
+    for (std::size_t i = 0; i < machines; ++i) {
+        result.dispatched += latencies[i].size();
+        result.samples.insert(result.samples.end(), latencies[i].begin(), latencies[i].end());
+    }
+    return result;
+}
+
+// Many producers post to a few turnstiles with small mailboxes, round after round, checking
+// after each Executor::wait_idle that every event posted so far has been dispatched.
+// Latency: of a round, from its first post to the return of Executor::wait_idle.
+Result run_stress(const Options& options) {
+    using Executor = unstately::Executor<unstately::StateMachine<Model::State>, 8>;
+    constexpr std::uint64_t rounds = 100;
+    const std::size_t machines = std::clamp<std::size_t>(options.machines, 1, 16);
+    const std::size_t producers = std::max<std::size_t>(2, options.producers);
+    const std::uint64_t per_round = std::max<std::uint64_t>(1, options.events / rounds);
+    std::vector<std::vector<std::uint64_t>> latencies(machines);
+    Result result{"stress", "round", per_round * rounds};
+    const std::uint64_t start = now_ns();
+    {
+        Executor executor{std::max<std::size_t>(1, options.threads), 4};
+        std::vector<Executor::Handle> handles;
+        for (std::size_t i = 0; i < machines; ++i) {
+            handles.push_back(executor.spawn(Context{&latencies[i]}, Model::Locked{}));
+        }
+        for (std::uint64_t round = 0; round < rounds; ++round) {
+            const std::uint64_t begin = now_ns();
+            run_threads(producers, [&](std::size_t producer) {
+                Mix mix{options.seed + round * producers + producer, options.coins};
+                for (std::uint64_t i = producer; i < per_round; i += producers) {
+                    const Executor::Handle machine = handles[i % machines];
+                    if (mix.coin()) {
+                        executor.post(machine, CoinInserted{now_ns()});
+                    } else {
+                        executor.post(machine, ArmPushed{now_ns()});
+                    }
+                }
+            });
+            executor.wait_idle();
+            result.samples.push_back(now_ns() - begin);
+            std::uint64_t dispatched = 0;
+            for (const auto& samples : latencies) {
+                dispatched += samples.size();
+            }
+            // Events still in the mailboxes would be dispatched later, but not waited for
+            if (dispatched != per_round * (round + 1)) {
+                break;
+            }
+            result.dispatched = dispatched;
+        }
+    }
+    result.seconds = static_cast<double>(now_ns() - start) * 1e-9;
+    return result;
+}
+
+// Each thread broadcasts events to its own shard of a fleet stored column-wise.
+// Latency: of a broadcast to a whole shard.
+Result run_bulk(const Options& options) {
+    using Fleet = unstately::BulkStateMachine<BulkModel::State>;
+    const std::size_t threads = std::max<std::size_t>(1, options.threads);
+    const std::size_t machines = std::max(options.machines, threads);
+    const std::uint64_t rounds = std::max<std::uint64_t>(1, options.events / machines);
+    std::vector<std::vector<std::uint64_t>> latencies(threads);
+    std::vector<std::uint64_t> dispatched(threads);
+    const std::uint64_t start = now_ns();
+    run_threads(threads, [&](std::size_t thread) {
+        Fleet fleet;
+        const std::size_t first = machines * thread / threads;
+        const std::size_t last = machines * (thread + 1) / threads;
+        fleet.reserve(last - first);
+        for (std::size_t i = first; i < last; ++i) {
+            fleet.add(Context{}, BulkModel::Locked{});
+        }
+        Mix mix{options.seed + thread, options.coins};
+        latencies[thread].reserve(rounds);
+        for (std::uint64_t round = 0; round < rounds; ++round) {
+            const std::uint64_t begin = now_ns();
+            if (mix.coin()) {
+                fleet.broadcast(CoinInserted{0});
+            } else {
+                fleet.broadcast(ArmPushed{0});
+            }
+            latencies[thread].push_back(now_ns() - begin);
+        }
+        for (std::size_t i = 0; i < fleet.size(); ++i) {
+            dispatched[thread] += fleet.context(i).dispatched;
+        }
+    });
+    Result result{"bulk", "broadcast", rounds * machines};
+    result.seconds = static_cast<double>(now_ns() - start) * 1e-9;
+    for (std::size_t i = 0; i < threads; ++i) {
+        result.dispatched += dispatched[i];
+        result.samples.insert(result.samples.end(), latencies[i].begin(), latencies[i].end());
+    }
+    return result;
+}
+
+// A state machine that times the replay of its log, from its first event to its last one.
+class TimedReplay {
+public:
+    TimedReplay(std::uint64_t events) : events_{events} {}
+
+    template <typename E>
+    void dispatch(const E& e) {
+        if (count_ == 0) {
+            begin_ = now_ns();
+        }
+        machine_.dispatch(e);
+        if (++count_ == events_) {
+            end_ = now_ns();
+        }
+    }
+
+    std::uint64_t elapsed() const noexcept {
+        return end_ - begin_;
+    }
+
+    std::uint64_t dispatched() const noexcept {
+        return machine_.context().dispatched;
+    }
+
+private:
+    unstately::StateMachine<Model::State> machine_{Context{}, Model::Locked{}};
+    std::uint64_t events_;
+    std::uint64_t count_{};
+    std::uint64_t begin_{};
+    std::uint64_t end_{};
+};
+
+// A pool of threads replays the event logs of the turnstiles, one log per turnstile.
+// Latency: of the replay of a whole log.
+Result run_replay(const Options& options) {
+    using Log = unstately::EventLog<Model::State>;
+    const std::size_t machines = std::max<std::size_t>(1, options.machines);
+    const std::uint64_t per_machine = std::max<std::uint64_t>(1, options.events / machines);
+    std::vector<std::vector<std::byte>> logs(machines);
+    std::vector<TimedReplay> fleet;
+    fleet.reserve(machines);
+    for (std::size_t i = 0; i < machines; ++i) {
+        Mix mix{options.seed + i, options.coins};
+        for (std::uint64_t n = 0; n < per_machine; ++n) {
+            if (mix.coin()) {
+                Log::append(logs[i], CoinInserted{0});
+            } else {
+                Log::append(logs[i], ArmPushed{0});
+            }
+        }
+        fleet.emplace_back(per_machine);
+    }
+    std::vector<Log::Job<TimedReplay>> jobs;
+    for (std::size_t i = 0; i < machines; ++i) {
+        jobs.push_back({&fleet[i], logs[i].data(), logs[i].size(), {}});
+    }
+    const std::uint64_t start = now_ns();
+    Log::replay_parallel(jobs.data(), jobs.size(), std::max<std::size_t>(1, options.threads));
+    Result result{"replay", "log", per_machine * machines};
+    result.seconds = static_cast<double>(now_ns() - start) * 1e-9;
+    for (std::size_t i = 0; i < machines; ++i) {
+        result.dispatched += fleet[i].dispatched();
+        result.samples.push_back(fleet[i].elapsed());
+    }
+    return result;
+}
+
+void report(const Options& options, Result& result) {
+    const double rate = static_cast<double>(result.dispatched) / result.seconds;
+    const std::uint64_t p50 = percentile(result.samples, 0.5);
+    const std::uint64_t p99 = percentile(result.samples, 0.99);
+    const std::uint64_t p999 = percentile(result.samples, 0.999);
+    const bool ok = result.dispatched == result.events;
+    if (options.format == "json") {
+        std::cout << std::fixed << std::setprecision(0) << "{\"scenario\":\"" << result.scenario
+                  << "\",\"version\":\"" << UNSTATELY_VERSION_MAJOR << '.'
+                  << UNSTATELY_VERSION_MINOR << '.' << UNSTATELY_VERSION_PATCH
+                  << "\",\"machines\":" << options.machines << ",\"threads\":" << options.threads
+                  << ",\"producers\":" << options.producers << ",\"coins\":" << options.coins
+                  << ",\"events\":" << result.events << ",\"dispatched\":" << result.dispatched
+                  << ",\"seconds\":" << std::setprecision(6) << result.seconds
+                  << ",\"events_per_second\":" << std::setprecision(0) << rate
+                  << ",\"latency\":\"" << result.latency << "\",\"p50_ns\":" << p50
+                  << ",\"p99_ns\":" << p99 << ",\"p999_ns\":" << p999
+                  << ",\"ok\":" << (ok ? "true" : "false") << "}\n";
+    } else {
+        std::cout << std::left << std::setw(10) << result.scenario << std::right << std::fixed
+                  << std::setprecision(0) << std::setw(14) << rate << " events/s  "
+                  << std::left << std::setw(18) << result.latency << std::right
+                  << " p50 " << std::setw(10) << p50 << " ns  p99 " << std::setw(10) << p99
+                  << " ns  p999 " << std::setw(10) << p999 << " ns  " << (ok ? "ok" : "LOST")
+                  << '\n';
+    }
+}
+
+bool parse(int argc, char* argv[], Options& options) {
+    for (int i = 1; i < argc; ++i) {
+        const std::string arg{argv[i]};
+        const std::size_t equal = arg.find('=');
+        if (arg.rfind("--", 0) != 0 || equal == std::string::npos) {
+            return false;
+        }
+        const std::string name = arg.substr(2, equal - 2);
+        const std::string value = arg.substr(equal + 1);
+        if (name == "scenario") {
+            options.scenario = value;
+        } else if (name == "format") {
+            options.format = value;
+        } else {
+            char* end = nullptr;
+            const unsigned long long number = std::strtoull(value.c_str(), &end, 10);
+            if (value.empty() || *end != '\0') {
+                return false;
+            }
+            if (name == "machines") {
+                options.machines = static_cast<std::size_t>(number);
+            } else if (name == "threads") {
+                options.threads = static_cast<std::size_t>(number);
+            } else if (name == "producers") {
+                options.producers = static_cast<std::size_t>(number);
+            } else if (name == "events") {
+                options.events = number;
+            } else if (name == "coins") {
+                options.coins = static_cast<unsigned>(std::min(number, 100ULL));
+            } else if (name == "seed") {
+                options.seed = number;
+            } else {
+                return false;
+            }
+        }
+    }
+    return options.format == "text" || options.format == "json";
+}
+
+} // namespace
+
+int main(int argc, char* argv[]) {
+    Options options{};
+    if (!parse(argc, argv, options)) {
+        std::cerr << "Usage: " << argv[0]
+                  << " [--scenario=all|async|executor|stress|bulk|replay] [--machines=N]"
+                     " [--threads=N] [--producers=N] [--events=N] [--coins=PERCENT] [--seed=N]"
+                     " [--format=text|json]\n";
+        return 2;
+    }
+    using Scenario = Result (*)(const Options&);
+    const std::pair<const char*, Scenario> scenarios[] = {{"async", &run_async},
+                                                          {"executor", &run_executor},
+                                                          {"stress", &run_stress},
+                                                          {"bulk", &run_bulk},
+                                                          {"replay", &run_replay}};
+    bool ok = true;
+    bool found = false;
+    for (const auto& [name, run] : scenarios) {
+        if (options.scenario == "all" || options.scenario == name) {
+            Result result = run(options);
+            report(options, result);
+            ok = ok && result.dispatched == result.events;
+            found = true;
+        }
+    }
+    if (!found) {
+        std::cerr << "Unknown scenario: " << options.scenario << '\n';
+        return 2;
+    }
+    return ok ? 0 : 1;
+}